@@ -1,8 +1,14 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // mremap
+#endif
+
 #include "gc.h"
+#include <math.h> // before log.h, which defines a `log` macro
 #include "log.h"
 
 #include <errno.h>
 #include <setjmp.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,11 +30,31 @@
  * Allocations can temporarily be tagged as "marked" an part of the
  * mark-and-sweep implementation or can be tagged as "roots" which are
  * not automatically garbage collected. The latter allows the implementation
- * of global variables.
+ * of global variables. "Atomic" allocations hold no pointers, their contents
+ * are never scanned. The pointers in "weak" allocations are not followed
+ * either, but cleared once their target is collected. "Ephemeron"
+ * allocations hold (key, value) pairs whose value is only followed while the
+ * key is reachable otherwise.
  */
 #define GC_TAG_NONE 0x0
 #define GC_TAG_ROOT 0x1
 #define GC_TAG_MARK 0x2
+#define GC_TAG_ATOMIC 0x4
+#define GC_TAG_WEAK 0x8
+#define GC_TAG_EPHEMERON 0x10
+
+/*
+ * Allocations of at least `gc->large_size` bytes are mapped directly from
+ * the system instead of going through malloc, see gc_large_map. They are
+ * tagged "large" for as long as they live.
+ */
+#define GC_TAG_LARGE 0x20
+
+/*
+ * Allocations sampled by the heap profiler, their site is kept in the
+ * profile, see gc_profile_sample.
+ */
+#define GC_TAG_SAMPLED 0x40
 
 /*
  * Support for windows c compiler is added by adding this macro.
@@ -39,6 +65,25 @@ extern void *_AddressOfReturnAddress(void);
 #define __builtin_frame_address(x) ((void)(x), _AddressOfReturnAddress())
 #endif
 
+/*
+ * The heap profiler records C call stacks with `backtrace` where the C
+ * library provides it, elsewhere only the label hook identifies a site.
+ */
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define GC_HAVE_BACKTRACE 1
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define GC_HAVE_MMAP 1
+#endif
+
 /*
  * Define a globally available GC object; this allows all code that
  * includes the gc.h header to access a global static garbage collector.
@@ -70,6 +115,31 @@ static size_t next_prime(size_t n) {
   return n;
 }
 
+/*
+ * The default backing allocator is the C library's.
+ */
+static void *gc_sys_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void *gc_sys_zalloc(void *ctx, size_t count, size_t size) {
+  (void)ctx;
+  return calloc(count, size);
+}
+
+static void *gc_sys_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+  (void)ctx, (void)old_size;
+  return realloc(ptr, size);
+}
+
+static void gc_sys_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx, (void)size;
+  free(ptr);
+}
+
+const GCAllocator gc_system_allocator = {gc_sys_alloc, gc_sys_zalloc, gc_sys_realloc, gc_sys_free, NULL};
+
 /**
  * The allocation object.
  *
@@ -81,26 +151,29 @@ typedef struct Allocation {
   size_t size;             // allocated size in bytes
   char tag;                // the tag for mark-and-sweep
   void (*dtor)(void *);    // destructor
+  size_t external;         // bytes of native memory owned by the allocation
   struct Allocation *next; // separate chaining
 } Allocation;
 
 /**
  * Create a new allocation object.
  *
- * Creates a new allocation object using the system `malloc`.
+ * Creates a new allocation object using the metadata allocator `meta`.
  *
+ * @param[in] meta The allocator for metadata.
  * @param[in] ptr The pointer to the memory to manage.
  * @param[in] size The size of the memory range pointed to by `ptr`.
  * @param[in] dtor A pointer to a destructor function that should be called
  *                 before freeing the memory pointed to by `ptr`.
  * @returns Pointer to the new allocation instance.
  */
-static Allocation *gc_allocation_new(void *ptr, size_t size, void (*dtor)(void *)) {
-  Allocation *a = (Allocation *)malloc(sizeof(Allocation));
+static Allocation *gc_allocation_new(const GCAllocator *meta, void *ptr, size_t size, void (*dtor)(void *)) {
+  Allocation *a = (Allocation *)meta->alloc(meta->ctx, sizeof(Allocation));
   a->ptr = ptr;
   a->size = size;
   a->tag = GC_TAG_NONE;
   a->dtor = dtor;
+  a->external = 0;
   a->next = NULL;
   return a;
 }
@@ -111,9 +184,12 @@ static Allocation *gc_allocation_new(void *ptr, size_t size, void (*dtor)(void *
  * Deletes the allocation object pointed to by `a`, but does *not*
  * free the memory pointed to by `a->ptr`.
  *
+ * @param meta The allocator `a` was allocated with.
  * @param a The allocation object to delete.
  */
-static void gc_allocation_delete(Allocation *a) { free(a); }
+static void gc_allocation_delete(const GCAllocator *meta, Allocation *a) {
+  meta->free(meta->ctx, a, sizeof(Allocation));
+}
 
 /**
  * The allocation hash map.
@@ -131,6 +207,7 @@ typedef struct AllocationMap {
   size_t sweep_limit;
   size_t size;
   Allocation **allocs;
+  const GCAllocator *meta; // allocator for the map and its entries
 } AllocationMap;
 
 /**
@@ -144,9 +221,10 @@ typedef struct AllocationMap {
  */
 static double gc_allocation_map_load_factor(AllocationMap *am) { return (double)am->size / (double)am->capacity; }
 
-static AllocationMap *gc_allocation_map_new(size_t min_capacity, size_t capacity, double sweep_factor,
-                                            double downsize_factor, double upsize_factor) {
-  AllocationMap *am = (AllocationMap *)malloc(sizeof(AllocationMap));
+static AllocationMap *gc_allocation_map_new(const GCAllocator *meta, size_t min_capacity, size_t capacity,
+                                            double sweep_factor, double downsize_factor, double upsize_factor) {
+  AllocationMap *am = (AllocationMap *)meta->alloc(meta->ctx, sizeof(AllocationMap));
+  am->meta = meta;
   am->min_capacity = next_prime(min_capacity);
   am->capacity = next_prime(capacity);
   if (am->capacity < am->min_capacity)
@@ -155,7 +233,7 @@ static AllocationMap *gc_allocation_map_new(size_t min_capacity, size_t capacity
   am->sweep_limit = (int)(sweep_factor * am->capacity);
   am->downsize_factor = downsize_factor;
   am->upsize_factor = upsize_factor;
-  am->allocs = (Allocation **)calloc(am->capacity, sizeof(Allocation *));
+  am->allocs = (Allocation **)meta->zalloc(meta->ctx, am->capacity, sizeof(Allocation *));
   am->size = 0;
   LOG_DEBUG("Created allocation map (cap=%zu, siz=%zu)", am->capacity, am->size);
   return am;
@@ -172,12 +250,13 @@ static void gc_allocation_map_delete(AllocationMap *am) {
         tmp = alloc;
         alloc = alloc->next;
         // free the management structure
-        gc_allocation_delete(tmp);
+        gc_allocation_delete(am->meta, tmp);
       }
     }
   }
-  free(am->allocs);
-  free(am);
+  const GCAllocator *meta = am->meta;
+  meta->free(meta->ctx, am->allocs, am->capacity * sizeof(Allocation *));
+  meta->free(meta->ctx, am, sizeof(AllocationMap));
 }
 
 static size_t gc_hash(void *ptr) { return ((uintptr_t)ptr) >> 3; }
@@ -189,7 +268,7 @@ static void gc_allocation_map_resize(AllocationMap *am, size_t new_capacity) {
   // Replaces the existing items array in the hash table
   // with a resized one and pushes items into the new, correct buckets
   LOG_DEBUG("Resizing allocation map (cap=%zu, siz=%zu) -> (cap=%zu)", am->capacity, am->size, new_capacity);
-  Allocation **resized_allocs = calloc(new_capacity, sizeof(Allocation *));
+  Allocation **resized_allocs = am->meta->zalloc(am->meta->ctx, new_capacity, sizeof(Allocation *));
 
   for (size_t i = 0; i < am->capacity; ++i) {
     Allocation *alloc = am->allocs[i];
@@ -201,7 +280,7 @@ static void gc_allocation_map_resize(AllocationMap *am, size_t new_capacity) {
       alloc = next_alloc;
     }
   }
-  free(am->allocs);
+  am->meta->free(am->meta->ctx, am->allocs, am->capacity * sizeof(Allocation *));
   am->capacity = new_capacity;
   am->allocs = resized_allocs;
   am->sweep_limit = am->size + am->sweep_factor * (am->capacity - am->size);
@@ -237,7 +316,7 @@ static Allocation *gc_allocation_map_get(AllocationMap *am, void *ptr) {
 static Allocation *gc_allocation_map_put(AllocationMap *am, void *ptr, size_t size, void (*dtor)(void *)) {
   size_t index = gc_hash(ptr) % am->capacity;
   LOG_DEBUG("PUT request for allocation ix=%zu", index);
-  Allocation *alloc = gc_allocation_new(ptr, size, dtor);
+  Allocation *alloc = gc_allocation_new(am->meta, ptr, size, dtor);
   Allocation *cur = am->allocs[index];
   Allocation *prev = NULL;
   /* Upsert if ptr is already known (e.g. dtor update). */
@@ -252,7 +331,7 @@ static Allocation *gc_allocation_map_put(AllocationMap *am, void *ptr, size_t si
         // in the list
         prev->next = alloc;
       }
-      gc_allocation_delete(cur);
+      gc_allocation_delete(am->meta, cur);
       LOG_DEBUG("AllocationMap Upsert at ix=%zu", index);
       return alloc;
     }
@@ -289,7 +368,7 @@ static void gc_allocation_map_remove(AllocationMap *am, void *ptr, bool allow_re
         // not the first item in the list
         prev->next = cur->next;
       }
-      gc_allocation_delete(cur);
+      gc_allocation_delete(am->meta, cur);
       am->size--;
     } else {
       // move on
@@ -302,29 +381,345 @@ static void gc_allocation_map_remove(AllocationMap *am, void *ptr, bool allow_re
   }
 }
 
-static void *gc_mcalloc(size_t count, size_t size) {
+static void *gc_mcalloc(GarbageCollector *gc, size_t count, size_t size) {
   if (!count)
-    return malloc(size);
-  return calloc(count, size);
+    return gc->payload.alloc(gc->payload.ctx, size);
+  return gc->payload.zalloc(gc->payload.ctx, count, size);
+}
+
+/**
+ * The large-object space.
+ *
+ * Large allocations get their own anonymous mapping: they do not fragment
+ * the malloc heap, their pages go back to the system as soon as they are
+ * swept, and growing them with `mremap` moves page table entries instead
+ * of copying. Mappings are zero filled, so calloc semantics come for free.
+ * With `gc->huge_pages`, mappings of at least GC_HUGE_PAGE bytes are
+ * advised to use transparent huge pages.
+ */
+#define GC_HUGE_PAGE (2 * 1024 * 1024)
+
+static bool gc_is_large(GarbageCollector *gc, size_t size) {
+#ifdef GC_HAVE_MMAP
+  return gc->large_size && size >= gc->large_size;
+#else
+  (void)gc;
+  (void)size;
+  return false;
+#endif
+}
+
+#ifdef GC_HAVE_MMAP
+static size_t gc_large_extent(size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+static void *gc_large_map(GarbageCollector *gc, size_t size) {
+  size_t extent = gc_large_extent(size);
+  void *ptr = mmap(NULL, extent, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (gc->huge_pages && extent >= GC_HUGE_PAGE) {
+    madvise(ptr, extent, MADV_HUGEPAGE);
+  }
+#endif
+  return ptr;
+}
+
+static void gc_large_unmap(void *ptr, size_t size) { munmap(ptr, gc_large_extent(size)); }
+#else
+static void *gc_large_map(GarbageCollector *gc, size_t size) {
+  (void)gc;
+  (void)size;
+  return NULL;
+}
+
+static void gc_large_unmap(void *ptr, size_t size) { (void)ptr, (void)size; }
+#endif
+
+/**
+ * The trace recorder.
+ *
+ * Events go to `gc->trace` as an opcode byte followed by unsigned LEB128
+ * operands, see gc.h for the format. Pointers are divided by the pointer
+ * size first, which keeps most of them at five bytes or less.
+ */
+#define GC_TRACE_PTR(p) ((uint64_t)(uintptr_t)(p) / PTRSIZE)
+
+static uint64_t gc_trace_kind(char tag) {
+  return tag & GC_TAG_EPHEMERON ? GC_TRACE_EPHEMERON
+         : tag & GC_TAG_WEAK    ? GC_TRACE_WEAK
+         : tag & GC_TAG_ATOMIC  ? GC_TRACE_ATOMIC
+                                : GC_TRACE_PLAIN;
+}
+
+static void gc_trace(GarbageCollector *gc, int op, size_t n, const uint64_t *operands) {
+  putc(op, gc->trace);
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t v = operands[i];
+    do {
+      putc((int)(v & 0x7F) | (v > 0x7F ? 0x80 : 0), gc->trace);
+      v >>= 7;
+    } while (v);
+  }
+}
+
+/* Returns the memory of an allocation to the space it came from. */
+static void gc_release(GarbageCollector *gc, Allocation *alloc) {
+  if (alloc->tag & GC_TAG_LARGE) {
+    gc_large_unmap(alloc->ptr, alloc->size);
+  } else {
+    gc->payload.free(gc->payload.ctx, alloc->ptr, alloc->size);
+  }
+}
+
+/**
+ * Check that `size` more bytes fit under the heap limit. If they do not, an
+ * emergency collection tries to make room before the request is refused.
+ */
+static bool gc_within_limit(GarbageCollector *gc, size_t size) {
+  if (!gc->heap_limit || gc->heap_size + gc->external_size + size <= gc->heap_limit) {
+    return true;
+  }
+  if (!gc->paused && gc->scan_stack) {
+    LOG_DEBUG("Heap limit of %zu bytes reached, collecting", gc->heap_limit);
+    gc_run(gc);
+  }
+  if (gc->heap_size + gc->external_size + size <= gc->heap_limit) {
+    return true;
+  }
+  LOG_WARNING("Refusing %zu bytes above the heap limit of %zu bytes", size, gc->heap_limit);
+  errno = ENOMEM;
+  return false;
+}
+
+/**
+ * Resize memory, possibly moving it between the malloc heap and the
+ * large-object space. Large objects that stay large are remapped.
+ */
+static void *gc_resize(GarbageCollector *gc, void *p, size_t old_size, bool was_large, size_t size, bool large) {
+  if (!was_large && !large) {
+    return gc->payload.realloc(gc->payload.ctx, p, old_size, size);
+  }
+#if defined(GC_HAVE_MMAP) && defined(MREMAP_MAYMOVE)
+  if (was_large && large) {
+    void *q = mremap(p, gc_large_extent(old_size), gc_large_extent(size), MREMAP_MAYMOVE);
+    return q == MAP_FAILED ? NULL : q;
+  }
+#endif
+  void *q = large ? gc_large_map(gc, size) : gc->payload.alloc(gc->payload.ctx, size);
+  if (q && p) {
+    memcpy(q, p, old_size < size ? old_size : size);
+    if (was_large) {
+      gc_large_unmap(p, old_size);
+    } else {
+      gc->payload.free(gc->payload.ctx, p, old_size);
+    }
+  }
+  return q;
+}
+
+static bool gc_needs_sweep(GarbageCollector *gc) {
+  return gc->allocs->size > gc->allocs->sweep_limit || gc->external_growth > gc->external_trigger;
+}
+
+/**
+ * The sampling heap profiler.
+ *
+ * Allocations are sampled as a Poisson process over allocated bytes: the
+ * distance to the next sample is drawn from an exponential distribution
+ * with a mean of `interval` bytes, so large allocations are more likely to
+ * be sampled and the unsampled fast path is a single subtraction. Every
+ * sample stands for `size / (1 - exp(-size / interval))` bytes, the
+ * expected amount of allocation it represents. Samples are grouped into
+ * sites by their C call stack and the label returned by an optional hook,
+ * e.g. the interpreter form being evaluated.
+ */
+#define GC_PROFILE_DEPTH 16
+#define GC_PROFILE_BUCKETS 256
+#define GC_PROFILE_TOP 10
+
+typedef struct GCSite {
+  void *frames[GC_PROFILE_DEPTH]; // innermost frame first
+  int depth;
+  char *label;
+  size_t samples;
+  size_t live;  // estimated bytes still allocated
+  size_t total; // estimated bytes allocated since profiling started
+  struct GCSite *next;
+} GCSite;
+
+/* The site of a sampled allocation */
+typedef struct GCSample {
+  void *ptr;
+  GCSite *site;
+} GCSample;
+
+typedef struct GCProfile {
+  size_t interval;
+  long long countdown; // bytes until the next sample
+  uint64_t rng;
+  const char *(*label)(void *data);
+  void *data;
+  FILE *report;
+  size_t nsites;
+  GCSite *sites[GC_PROFILE_BUCKETS];
+  GCSample *samples; // open addressing table of live samples, keyed by pointer
+  size_t nsamples, samples_cap;
+} GCProfile;
+
+static void gc_profile_reset(GCProfile *p) {
+  /* xorshift64*, uniform in (0, 1] */
+  p->rng ^= p->rng >> 12;
+  p->rng ^= p->rng << 25;
+  p->rng ^= p->rng >> 27;
+  double u = (double)((p->rng * 0x2545F4914F6CDD1Dull) >> 11 | 1) / 9007199254740992.0;
+  p->countdown = (long long)(-log2(u) * M_LN2 * (double)p->interval);
+}
+
+static size_t gc_profile_weight(GCProfile *p, size_t size) {
+  return size ? (size_t)((double)size / -expm1(-(double)size / (double)p->interval)) : 0;
+}
+
+static size_t gc_profile_hash(void *const *frames, int depth, const char *label) {
+  size_t h = 14695981039346656037ull;
+  for (int i = 0; i < depth; ++i)
+    h = (h ^ (uintptr_t)frames[i]) * 1099511628211ull;
+  for (; label && *label; ++label)
+    h = (h ^ (unsigned char)*label) * 1099511628211ull;
+  return h;
+}
+
+/* Returns the slot of `ptr` in the sample table, or the free slot it would take. */
+static size_t gc_profile_slot(GCProfile *p, void *ptr) {
+  size_t mask = p->samples_cap - 1, i = gc_hash(ptr) & mask;
+  while (p->samples[i].ptr && p->samples[i].ptr != ptr) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Records `site` for the sampled allocation `alloc`, returns false if the table cannot grow. */
+static bool gc_profile_attach(GarbageCollector *gc, Allocation *alloc, GCSite *site) {
+  GCProfile *p = gc->profile;
+  if (2 * (p->nsamples + 1) > p->samples_cap) {
+    size_t cap = p->samples_cap ? 2 * p->samples_cap : 64;
+    GCSample *old = p->samples;
+    size_t old_cap = p->samples_cap;
+    GCSample *samples = (GCSample *)gc->metadata.zalloc(gc->metadata.ctx, cap, sizeof(GCSample));
+    if (!samples) {
+      return false;
+    }
+    p->samples = samples;
+    p->samples_cap = cap;
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (old[i].ptr) {
+        p->samples[gc_profile_slot(p, old[i].ptr)] = old[i];
+      }
+    }
+    if (old) {
+      gc->metadata.free(gc->metadata.ctx, old, old_cap * sizeof(GCSample));
+    }
+  }
+  size_t weight = gc_profile_weight(p, alloc->size);
+  site->live += weight;
+  p->samples[gc_profile_slot(p, alloc->ptr)] = (GCSample){alloc->ptr, site};
+  p->nsamples++;
+  alloc->tag |= GC_TAG_SAMPLED;
+  return true;
+}
+
+static __attribute__((noinline)) void gc_profile_sample(GarbageCollector *gc, Allocation *alloc) {
+  GCProfile *p = gc->profile;
+  gc_profile_reset(p);
+  void *frames[GC_PROFILE_DEPTH + 1];
+  int depth = 0;
+#ifdef GC_HAVE_BACKTRACE
+  depth = backtrace(frames, GC_PROFILE_DEPTH + 1) - 1; // drop this function
+  depth = depth < 0 ? 0 : depth;
+#endif
+  const char *label = p->label ? p->label(p->data) : NULL;
+  size_t bucket = gc_profile_hash(frames + 1, depth, label) % GC_PROFILE_BUCKETS;
+  GCSite *site = p->sites[bucket];
+  while (site && (site->depth != depth || memcmp(site->frames, frames + 1, depth * sizeof(void *)) ||
+                  (site->label ? !label || strcmp(site->label, label) : label != NULL))) {
+    site = site->next;
+  }
+  if (!site) {
+    size_t len = label ? strlen(label) + 1 : 0;
+    site = (GCSite *)gc->metadata.zalloc(gc->metadata.ctx, 1, sizeof(GCSite));
+    if (!site) {
+      return;
+    }
+    if (label && !(site->label = (char *)gc->metadata.alloc(gc->metadata.ctx, len))) {
+      gc->metadata.free(gc->metadata.ctx, site, sizeof(GCSite));
+      return;
+    }
+    if (label) {
+      memcpy(site->label, label, len);
+    }
+    memcpy(site->frames, frames + 1, depth * sizeof(void *));
+    site->depth = depth;
+    site->next = p->sites[bucket];
+    p->sites[bucket] = site;
+    p->nsites++;
+  }
+  if (gc_profile_attach(gc, alloc, site)) {
+    site->samples++;
+    site->total += gc_profile_weight(p, alloc->size);
+  }
 }
 
-static bool gc_needs_sweep(GarbageCollector *gc) { return gc->allocs->size > gc->allocs->sweep_limit; }
+/* Accounts for a sampled allocation that is freed, returns its site or NULL if it was not sampled. */
+static GCSite *gc_profile_release(GarbageCollector *gc, Allocation *alloc) {
+  if (!(alloc->tag & GC_TAG_SAMPLED)) {
+    return NULL;
+  }
+  GCProfile *p = gc->profile;
+  size_t mask = p->samples_cap - 1, i = gc_profile_slot(p, alloc->ptr);
+  GCSite *site = p->samples[i].site;
+  site->live -= gc_profile_weight(p, alloc->size);
+  alloc->tag &= ~GC_TAG_SAMPLED;
+  p->nsamples--;
+  /* Shift the rest of the probe sequence back over the hole */
+  for (size_t j = (i + 1) & mask; p->samples[j].ptr; j = (j + 1) & mask) {
+    size_t home = gc_hash(p->samples[j].ptr) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      p->samples[i] = p->samples[j];
+      i = j;
+    }
+  }
+  p->samples[i] = (GCSample){NULL, NULL};
+  return site;
+}
 
-static void *gc_allocate(GarbageCollector *gc, size_t count, size_t size, void (*dtor)(void *)) {
+static void *gc_allocate(GarbageCollector *gc, size_t count, size_t size, void (*dtor)(void *), char tag) {
   /* Allocation logic that generalizes over malloc/calloc. */
 
   /* Check if we reached the high-water mark and need to clean up */
-  if (gc_needs_sweep(gc) && !gc->paused) {
+  if (gc_needs_sweep(gc) && !gc->paused && gc->scan_stack) {
     size_t freed_mem = gc_run(gc);
     LOG_DEBUG("Garbage collection cleaned up %zu bytes.", freed_mem);
   }
+  if (count && size > SIZE_MAX / count) {
+    errno = ENOMEM;
+    return NULL;
+  }
   /* With cleanup out of the way, attempt to allocate memory */
-  void *ptr = gc_mcalloc(count, size);
   size_t alloc_size = count ? count * size : size;
+  if (!gc_within_limit(gc, alloc_size)) {
+    return NULL;
+  }
+  bool large = gc_is_large(gc, alloc_size);
+  void *ptr = large ? gc_large_map(gc, alloc_size) : gc_mcalloc(gc, count, size);
   /* If allocation fails, force an out-of-policy run to free some memory and try again. */
-  if (!ptr && !gc->paused && (errno == EAGAIN || errno == ENOMEM)) {
+  if (!ptr && !gc->paused && gc->scan_stack && (errno == EAGAIN || errno == ENOMEM)) {
     gc_run(gc);
-    ptr = gc_mcalloc(count, size);
+    ptr = large ? gc_large_map(gc, alloc_size) : gc_mcalloc(gc, count, size);
   }
   /* Start managing the memory we received from the system */
   if (ptr) {
@@ -333,10 +728,22 @@ static void *gc_allocate(GarbageCollector *gc, size_t count, size_t size, void (
     /* Deal with metadata allocation failure */
     if (alloc) {
       LOG_DEBUG("Managing %zu bytes at %p", alloc_size, (void *)alloc->ptr);
+      alloc->tag = large ? tag | GC_TAG_LARGE : tag;
       ptr = alloc->ptr;
+      gc->heap_size += alloc_size;
+      if (gc->trace) {
+        gc_trace(gc, GC_TRACE_ALLOC, 3, (uint64_t[]){GC_TRACE_PTR(ptr), alloc_size, gc_trace_kind(tag)});
+      }
+      if (gc->profile && (gc->profile->countdown -= (long long)alloc_size) < 0) {
+        gc_profile_sample(gc, alloc);
+      }
     } else {
       /* We failed to allocate the metadata, fail cleanly. */
-      free(ptr);
+      if (large) {
+        gc_large_unmap(ptr, alloc_size);
+      } else {
+        gc->payload.free(gc->payload.ctx, ptr, alloc_size);
+      }
       ptr = NULL;
     }
   }
@@ -347,6 +754,9 @@ static void gc_make_root(GarbageCollector *gc, void *ptr) {
   Allocation *alloc = gc_allocation_map_get(gc->allocs, ptr);
   if (alloc) {
     alloc->tag |= GC_TAG_ROOT;
+    if (gc->trace) {
+      gc_trace(gc, GC_TRACE_ROOT, 1, (uint64_t[]){GC_TRACE_PTR(ptr)});
+    }
   }
 }
 
@@ -363,12 +773,50 @@ void *gc_make_static(GarbageCollector *gc, void *ptr) {
   return ptr;
 }
 
-void *gc_malloc_ext(GarbageCollector *gc, size_t size, void (*dtor)(void *)) { return gc_allocate(gc, 0, size, dtor); }
+bool gc_owns(GarbageCollector *gc, void *ptr) { return gc_allocation_map_get(gc->allocs, ptr) != NULL; }
+
+/**
+ * Account native memory to an allocation. Native bytes are released with
+ * the allocation (typically by its destructor), so they count toward the
+ * heap limit, and reporting more of them brings the next collection
+ * closer: one is due once they grew by the external size of the last
+ * collection, or by at least GC_EXTERNAL_TRIGGER bytes.
+ */
+bool gc_external(GarbageCollector *gc, void *ptr, ptrdiff_t delta) {
+  Allocation *alloc = gc_allocation_map_get(gc->allocs, ptr);
+  if (!alloc) {
+    return false;
+  }
+  if (delta < 0) {
+    size_t less = (size_t)-delta < alloc->external ? (size_t)-delta : alloc->external;
+    alloc->external -= less;
+    gc->external_size -= less;
+  } else {
+    alloc->external += (size_t)delta;
+    gc->external_size += (size_t)delta;
+    gc->external_growth += (size_t)delta;
+  }
+  return true;
+}
+
+void *gc_malloc_ext(GarbageCollector *gc, size_t size, void (*dtor)(void *)) {
+  return gc_allocate(gc, 0, size, dtor, GC_TAG_NONE);
+}
+
+void *gc_malloc_atomic(GarbageCollector *gc, size_t size) { return gc_allocate(gc, 0, size, NULL, GC_TAG_ATOMIC); }
+
+void *gc_calloc_weak(GarbageCollector *gc, size_t count) {
+  return gc_allocate(gc, count, PTRSIZE, NULL, GC_TAG_WEAK);
+}
+
+void *gc_calloc_ephemeron(GarbageCollector *gc, size_t count) {
+  return gc_allocate(gc, count, 2 * PTRSIZE, NULL, GC_TAG_EPHEMERON);
+}
 
 void *gc_calloc(GarbageCollector *gc, size_t count, size_t size) { return gc_calloc_ext(gc, count, size, NULL); }
 
 void *gc_calloc_ext(GarbageCollector *gc, size_t count, size_t size, void (*dtor)(void *)) {
-  return gc_allocate(gc, count, size, dtor);
+  return gc_allocate(gc, count, size, dtor, GC_TAG_NONE);
 }
 
 void *gc_realloc(GarbageCollector *gc, void *p, size_t size) {
@@ -378,16 +826,35 @@ void *gc_realloc(GarbageCollector *gc, void *p, size_t size) {
     errno = EINVAL;
     return NULL;
   }
-  void *q = realloc(p, size);
+  size_t old_size = alloc ? alloc->size : 0;
+  if (size > old_size && !gc_within_limit(gc, size - old_size)) {
+    return NULL;
+  }
+  // an emergency collection may have moved the metadata
+  alloc = p ? gc_allocation_map_get(gc->allocs, p) : NULL;
+  bool was_large = alloc && (alloc->tag & GC_TAG_LARGE), large = gc_is_large(gc, size);
+  void *q = gc_resize(gc, p, old_size, was_large, size, large);
   if (!q) {
     // realloc failed but p is still valid
     return NULL;
   }
+  gc->heap_size += size - old_size;
+  if (gc->trace) {
+    if (p) {
+      gc_trace(gc, GC_TRACE_REALLOC, 3, (uint64_t[]){GC_TRACE_PTR(p), GC_TRACE_PTR(q), size});
+    } else {
+      gc_trace(gc, GC_TRACE_ALLOC, 3, (uint64_t[]){GC_TRACE_PTR(q), size, GC_TRACE_PLAIN});
+    }
+  }
   if (!p) {
     // allocation, not reallocation
     Allocation *alloc = gc_allocation_map_put(gc->allocs, q, size, NULL);
+    alloc->tag = large ? GC_TAG_LARGE : GC_TAG_NONE;
     return alloc->ptr;
   }
+  size_t external = alloc->external;
+  GCSite *site = gc_profile_release(gc, alloc);
+  char tag = (char)(large ? alloc->tag | GC_TAG_LARGE : alloc->tag & ~GC_TAG_LARGE);
   if (p == q) {
     // successful reallocation w/o copy
     alloc->size = size;
@@ -395,7 +862,13 @@ void *gc_realloc(GarbageCollector *gc, void *p, size_t size) {
     // successful reallocation w/ copy
     void (*dtor)(void *) = alloc->dtor;
     gc_allocation_map_remove(gc->allocs, p, true);
-    gc_allocation_map_put(gc->allocs, q, size, dtor);
+    alloc = gc_allocation_map_put(gc->allocs, q, size, dtor);
+  }
+  alloc->tag = tag;
+  alloc->external = external;
+  if (site) {
+    // the site keeps accounting for the resized allocation, unless the table cannot grow
+    gc_profile_attach(gc, alloc, site);
   }
   return q;
 }
@@ -406,46 +879,230 @@ void gc_free(GarbageCollector *gc, void *ptr) {
     if (alloc->dtor) {
       alloc->dtor(ptr);
     }
-    free(ptr);
+    if (gc->trace) {
+      gc_trace(gc, GC_TRACE_FREE, 1, (uint64_t[]){GC_TRACE_PTR(ptr)});
+    }
+    gc_profile_release(gc, alloc);
+    gc->heap_size -= alloc->size;
+    gc->external_size -= alloc->external;
+    gc_release(gc, alloc);
     gc_allocation_map_remove(gc->allocs, ptr, true);
   } else {
     LOG_WARNING("Ignoring request to free unknown pointer %p", (void *)ptr);
   }
 }
 
+static void gc_init(GarbageCollector *gc, void *bos, const GCAllocator *payload, const GCAllocator *metadata,
+                    size_t initial_capacity, size_t min_capacity, double downsize_load_factor,
+                    double upsize_load_factor, double sweep_factor);
+
 void gc_start(GarbageCollector *gc, void *bos) { gc_start_ext(gc, bos, 1024, 1024, 0.2, 0.8, 0.5); }
 
+void gc_start_alloc(GarbageCollector *gc, void *bos, const GCAllocator *payload, const GCAllocator *metadata) {
+  gc_init(gc, bos, payload, metadata, 1024, 1024, 0.2, 0.8, 0.5);
+}
+
+void gc_large_objects(GarbageCollector *gc, size_t threshold, bool huge_pages) {
+  gc->large_size = threshold;
+  gc->huge_pages = huge_pages;
+}
+
+void gc_heap_limit(GarbageCollector *gc, size_t limit) { gc->heap_limit = limit; }
+
+/**
+ * Return free memory of the malloc heap to the system. Large objects are
+ * unmapped when they are swept, what remains are the free pages malloc
+ * holds on to, which `malloc_trim` releases with MADV_DONTNEED.
+ */
+void gc_scavenge(GarbageCollector *gc) {
+#if defined(__GLIBC__)
+  if (gc->payload.free == gc_sys_free) {
+    malloc_trim(0);
+  }
+#endif
+  gc->unreturned = 0;
+}
+
 void gc_start_ext(GarbageCollector *gc, void *bos, size_t initial_capacity, size_t min_capacity,
                   double downsize_load_factor, double upsize_load_factor, double sweep_factor) {
+  gc_init(gc, bos, NULL, NULL, initial_capacity, min_capacity, downsize_load_factor, upsize_load_factor,
+          sweep_factor);
+}
+
+/**
+ * Initialize a collector. Custom payload memory is not bypassed by the
+ * large-object space unless it is enabled again with gc_large_objects.
+ */
+static void gc_init(GarbageCollector *gc, void *bos, const GCAllocator *payload, const GCAllocator *metadata,
+                    size_t initial_capacity, size_t min_capacity, double downsize_load_factor,
+                    double upsize_load_factor, double sweep_factor) {
   double downsize_limit = downsize_load_factor > 0.0 ? downsize_load_factor : 0.2;
   double upsize_limit = upsize_load_factor > 0.0 ? upsize_load_factor : 0.8;
   sweep_factor = sweep_factor > 0.0 ? sweep_factor : 0.5;
   gc->paused = false;
   gc->bos = bos;
+  gc->profile = NULL;
+  gc->payload = payload ? *payload : gc_system_allocator;
+  gc->metadata = metadata ? *metadata : gc_system_allocator;
+  gc->large_size = payload ? 0 : GC_LARGE_SIZE;
+  gc->huge_pages = false;
+  gc->heap_size = gc->heap_limit = gc->unreturned = 0;
+  gc->external_size = gc->external_growth = 0;
+  gc->external_trigger = GC_EXTERNAL_TRIGGER;
+  gc->scan_stack = true;
+  gc->collections = 0;
+  gc->trace = NULL;
+  gc->roots = NULL;
+  gc->nroots = gc->roots_cap = 0;
+  gc->weak = NULL;
+  gc->nweak = gc->weak_cap = 0;
+  gc->weak_overflow = false;
   initial_capacity = initial_capacity < min_capacity ? min_capacity : initial_capacity;
-  gc->allocs = gc_allocation_map_new(min_capacity, initial_capacity, sweep_factor, downsize_limit, upsize_limit);
+  gc->allocs = gc_allocation_map_new(&gc->metadata, min_capacity, initial_capacity, sweep_factor, downsize_limit,
+                                     upsize_limit);
   LOG_DEBUG("Created new garbage collector (cap=%zu, siz=%zu).", gc->allocs->capacity, gc->allocs->size);
 }
 
 void gc_pause(GarbageCollector *gc) { gc->paused = true; }
 
+/**
+ * Precise roots.
+ *
+ * Registered slots are marked through on every collection. Registration is
+ * cheapest in LIFO order, which is what GC_ROOT does, but any order works.
+ * Without stack scanning the registered slots (and static allocations) are
+ * the only roots, so allocations never collect implicitly: collections
+ * happen in gc_run or at gc_safepoint, where the caller knows that every
+ * live pointer is registered.
+ */
+void gc_add_root(GarbageCollector *gc, void **slot) {
+  if (gc->nroots == gc->roots_cap) {
+    size_t cap = gc->roots_cap ? 2 * gc->roots_cap : 64;
+    void ***roots = (void ***)gc->metadata.realloc(gc->metadata.ctx, gc->roots, gc->roots_cap * sizeof(void **),
+                                                   cap * sizeof(void **));
+    if (!roots) {
+      /* A slot that is not registered would let its target be freed while in use */
+      LOG_CRITICAL("Could not register root %p", (void *)slot);
+      abort();
+    }
+    gc->roots = roots;
+    gc->roots_cap = cap;
+  }
+  gc->roots[gc->nroots++] = slot;
+  if (gc->trace) {
+    gc_trace(gc, GC_TRACE_ADD_ROOT, 1, (uint64_t[]){GC_TRACE_PTR(slot)});
+  }
+}
+
+void gc_remove_root(GarbageCollector *gc, void **slot) {
+  for (size_t i = gc->nroots; i-- > 0;) {
+    if (gc->roots[i] == slot) {
+      memmove(gc->roots + i, gc->roots + i + 1, (gc->nroots - i - 1) * sizeof(void **));
+      gc->nroots--;
+      if (gc->trace) {
+        gc_trace(gc, GC_TRACE_REMOVE_ROOT, 1, (uint64_t[]){GC_TRACE_PTR(slot)});
+      }
+      return;
+    }
+  }
+}
+
+size_t gc_root_mark(GarbageCollector *gc) { return gc->nroots; }
+
+void gc_root_reset(GarbageCollector *gc, size_t mark) {
+  while (gc->nroots > mark) {
+    void **slot = gc->roots[--gc->nroots];
+    if (gc->trace) {
+      gc_trace(gc, GC_TRACE_REMOVE_ROOT, 1, (uint64_t[]){GC_TRACE_PTR(slot)});
+    }
+  }
+}
+
+void gc_scan_stack(GarbageCollector *gc, bool enabled) { gc->scan_stack = enabled; }
+
+/**
+ * Allocations do not collect without stack scanning, so a safepoint also
+ * collects once less than an eighth of the heap limit is left.
+ */
+static bool gc_near_limit(GarbageCollector *gc) {
+  return gc->heap_limit && gc->heap_size + gc->external_size > gc->heap_limit - gc->heap_limit / 8;
+}
+
+bool gc_safepoint(GarbageCollector *gc) {
+  if (gc->paused || !(gc_needs_sweep(gc) || gc_near_limit(gc))) {
+    return false;
+  }
+  gc_run(gc);
+  return true;
+}
+
 void gc_resume(GarbageCollector *gc) { gc->paused = false; }
 
-void gc_mark_alloc(GarbageCollector *gc, void *ptr) {
+/**
+ * Remembers a marked weak allocation or ephemeron, so that the weak passes
+ * only visit those instead of the whole allocation map.
+ */
+static void gc_remember_weak(GarbageCollector *gc, Allocation *alloc) {
+  if (gc->weak_overflow) {
+    return;
+  }
+  if (gc->nweak == gc->weak_cap) {
+    size_t cap = gc->weak_cap ? 2 * gc->weak_cap : 64;
+    size_t size = sizeof(Allocation *);
+    Allocation **weak =
+        (Allocation **)gc->metadata.realloc(gc->metadata.ctx, gc->weak, gc->weak_cap * size, cap * size);
+    if (!weak) {
+      LOG_WARNING("Could not grow the weak list, walking the allocation map%s", "");
+      gc->weak_overflow = true;
+      return;
+    }
+    gc->weak = weak;
+    gc->weak_cap = cap;
+  }
+  gc->weak[gc->nweak++] = alloc;
+}
+
+/**
+ * Marks `ptr` found in the contents of the allocation `parent`, or in a root
+ * or on the stack if `parent` is NULL. A trace records every reference that
+ * leads to an allocation, so that gc_replay can rebuild the object graph.
+ */
+static void gc_mark_from(GarbageCollector *gc, void *parent, void *ptr) {
+  /* Allocations are at least pointer aligned, so unaligned values (e.g. tagged immediates) never refer to one */
+  if ((uintptr_t)ptr % PTRSIZE) {
+    return;
+  }
   Allocation *alloc = gc_allocation_map_get(gc->allocs, ptr);
+  if (alloc && gc->trace) {
+    if (parent) {
+      gc_trace(gc, GC_TRACE_EDGE, 2, (uint64_t[]){GC_TRACE_PTR(parent), GC_TRACE_PTR(ptr)});
+    } else {
+      gc_trace(gc, GC_TRACE_REACH, 1, (uint64_t[]){GC_TRACE_PTR(ptr)});
+    }
+  }
   /* Mark if alloc exists and is not tagged already, otherwise skip */
   if (alloc && !(alloc->tag & GC_TAG_MARK)) {
     LOG_DEBUG("Marking allocation (ptr=%p)", ptr);
     alloc->tag |= GC_TAG_MARK;
-    /* Iterate over allocation contents and mark them as well */
+    if (alloc->tag & (GC_TAG_WEAK | GC_TAG_EPHEMERON)) {
+      gc_remember_weak(gc, alloc);
+      return;
+    }
+    if (alloc->tag & GC_TAG_ATOMIC) {
+      return;
+    }
+    /* Iterate over allocation contents and mark them as well, large objects only hold aligned pointers */
     LOG_DEBUG("Checking allocation (ptr=%p, size=%zu) contents", ptr, alloc->size);
-    for (char *p = (char *)alloc->ptr; p <= (char *)alloc->ptr + alloc->size - PTRSIZE; ++p) {
+    size_t step = alloc->tag & GC_TAG_LARGE ? PTRSIZE : 1;
+    for (char *p = (char *)alloc->ptr; p <= (char *)alloc->ptr + alloc->size - PTRSIZE; p += step) {
       LOG_DEBUG("Checking allocation (ptr=%p) @%zu with value %p", ptr, p - ((char *)alloc->ptr), *(void **)p);
-      gc_mark_alloc(gc, *(void **)p);
+      gc_mark_from(gc, ptr, *(void **)p);
     }
   }
 }
 
+void gc_mark_alloc(GarbageCollector *gc, void *ptr) { gc_mark_from(gc, NULL, ptr); }
+
 void gc_mark_stack(GarbageCollector *gc) {
   LOG_DEBUG("Marking the stack (gc@%p) in increments of %zu", (void *)gc, sizeof(char));
   void *tos = __builtin_frame_address(0);
@@ -469,23 +1126,121 @@ void gc_mark_roots(GarbageCollector *gc) {
       chunk = chunk->next;
     }
   }
+  for (size_t i = 0; i < gc->nroots; ++i) {
+    gc_mark_alloc(gc, *gc->roots[i]);
+  }
+}
+
+/**
+ * Checks whether `ptr` survives the current collection, values that are not
+ * managed by `gc` always do.
+ */
+static bool gc_alive(GarbageCollector *gc, void *ptr) {
+  Allocation *alloc = (uintptr_t)ptr % PTRSIZE ? NULL : gc_allocation_map_get(gc->allocs, ptr);
+  return !alloc || (alloc->tag & GC_TAG_MARK);
+}
+
+/**
+ * Marks the values of `chunk`, an ephemeron, whose keys are reachable.
+ * Returns whether anything new was marked.
+ */
+static bool gc_mark_ephemeron(GarbageCollector *gc, Allocation *chunk) {
+  bool changed = false;
+  void **pair = (void **)chunk->ptr;
+  for (size_t j = 0; j + 1 < chunk->size / PTRSIZE; j += 2) {
+    if (pair[j] && gc_alive(gc, pair[j]) && !gc_alive(gc, pair[j + 1])) {
+      gc_mark_alloc(gc, pair[j + 1]);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/**
+ * Marks the values of reachable ephemerons whose keys are reachable. Marking
+ * a value can make further keys and ephemerons reachable, so this repeats
+ * until a pass marks nothing new.
+ */
+static void gc_mark_ephemerons(GarbageCollector *gc) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    if (!gc->weak_overflow) {
+      /* Marking appends to the list, those ephemerons are visited in the same pass */
+      for (size_t i = 0; i < gc->nweak; ++i) {
+        if (gc->weak[i]->tag & GC_TAG_EPHEMERON) {
+          changed |= gc_mark_ephemeron(gc, gc->weak[i]);
+        }
+      }
+      continue;
+    }
+    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
+      for (Allocation *chunk = gc->allocs->allocs[i]; chunk; chunk = chunk->next) {
+        if ((chunk->tag & (GC_TAG_EPHEMERON | GC_TAG_MARK)) == (GC_TAG_EPHEMERON | GC_TAG_MARK)) {
+          changed |= gc_mark_ephemeron(gc, chunk);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Clears the slots of weak allocations that point to dead allocations and
+ * the pairs of ephemerons with dead keys. A cleared key is set to
+ * GC_CLEARED, so open addressing tables can tell it from a free slot.
+ */
+static void gc_clear_slots(GarbageCollector *gc, Allocation *chunk) {
+  void **slot = (void **)chunk->ptr;
+  size_t n = chunk->size / PTRSIZE;
+  for (size_t j = 0; j < n; ++j) {
+    if (chunk->tag & GC_TAG_WEAK) {
+      if (slot[j] && !gc_alive(gc, slot[j])) {
+        slot[j] = NULL;
+      }
+    } else if (j % 2 == 0 && j + 1 < n && slot[j] && !gc_alive(gc, slot[j])) {
+      slot[j] = GC_CLEARED;
+      slot[j + 1] = NULL;
+    }
+  }
+}
+
+static void gc_clear_weak(GarbageCollector *gc) {
+  if (!gc->weak_overflow) {
+    for (size_t i = 0; i < gc->nweak; ++i) {
+      gc_clear_slots(gc, gc->weak[i]);
+    }
+  } else {
+    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
+      for (Allocation *chunk = gc->allocs->allocs[i]; chunk; chunk = chunk->next) {
+        if ((chunk->tag & GC_TAG_MARK) && (chunk->tag & (GC_TAG_WEAK | GC_TAG_EPHEMERON))) {
+          gc_clear_slots(gc, chunk);
+        }
+      }
+    }
+  }
+  gc->nweak = 0;
+  gc->weak_overflow = false;
 }
 
 void gc_mark(GarbageCollector *gc) {
   /* Note: We only look at the stack and the heap, and ignore BSS. */
   LOG_DEBUG("Initiating GC mark (gc@%p)", (void *)gc);
-  /* Scan the heap for roots */
+  /* Scan the heap and the registered slots for roots */
   gc_mark_roots(gc);
-  /* Dump registers onto stack and scan the stack */
-  void (*volatile _mark_stack)(GarbageCollector *) = gc_mark_stack;
-  jmp_buf ctx;
-  memset(&ctx, 0, sizeof(jmp_buf));
-  setjmp(ctx);
-  _mark_stack(gc);
+  if (gc->scan_stack) {
+    /* Dump registers onto stack and scan the stack */
+    void (*volatile _mark_stack)(GarbageCollector *) = gc_mark_stack;
+    jmp_buf ctx;
+    memset(&ctx, 0, sizeof(jmp_buf));
+    setjmp(ctx);
+    _mark_stack(gc);
+  }
+  gc_mark_ephemerons(gc);
 }
 
 size_t gc_sweep(GarbageCollector *gc) {
   LOG_DEBUG("Initiating GC sweep (gc@%p)", (void *)gc);
+  gc_clear_weak(gc);
   size_t total = 0;
   for (size_t i = 0; i < gc->allocs->capacity; ++i) {
     Allocation *chunk = gc->allocs->allocs[i];
@@ -501,10 +1256,18 @@ size_t gc_sweep(GarbageCollector *gc) {
         LOG_DEBUG("Found unused allocation %p (%zu bytes @ ptr=%p)", (void *)chunk, chunk->size, (void *)chunk->ptr);
         /* no reference to this chunk, hence delete it */
         total += chunk->size;
+        gc->external_size -= chunk->external;
+        if (gc->trace) {
+          gc_trace(gc, GC_TRACE_DEAD, 1, (uint64_t[]){GC_TRACE_PTR(chunk->ptr)});
+        }
+        if (!(chunk->tag & GC_TAG_LARGE)) {
+          gc->unreturned += chunk->size;
+        }
         if (chunk->dtor) {
           chunk->dtor(chunk->ptr);
         }
-        free(chunk->ptr);
+        gc_profile_release(gc, chunk);
+        gc_release(gc, chunk);
         /* and remove it from the bookkeeping */
         next = chunk->next;
         gc_allocation_map_remove(gc->allocs, chunk->ptr, false);
@@ -513,6 +1276,13 @@ size_t gc_sweep(GarbageCollector *gc) {
     }
   }
   gc_allocation_map_resize_to_fit(gc->allocs);
+  gc->heap_size -= total;
+  gc->external_growth = 0;
+  gc->external_trigger = gc->external_size > GC_EXTERNAL_TRIGGER ? gc->external_size : GC_EXTERNAL_TRIGGER;
+  /* Scavenge once enough has been freed to be worth the walk over the malloc heap */
+  if (gc->unreturned >= GC_SCAVENGE_SIZE) {
+    gc_scavenge(gc);
+  }
   return total;
 }
 
@@ -537,14 +1307,36 @@ void gc_unroot_roots(GarbageCollector *gc) {
 size_t gc_stop(GarbageCollector *gc) {
   gc_unroot_roots(gc);
   size_t collected = gc_sweep(gc);
+  gc_profile_stop(gc);
+  gc_trace_stop(gc);
+  if (gc->roots) {
+    gc->metadata.free(gc->metadata.ctx, gc->roots, gc->roots_cap * sizeof(void **));
+  }
+  gc->roots = NULL;
+  gc->nroots = gc->roots_cap = 0;
+  if (gc->weak) {
+    gc->metadata.free(gc->metadata.ctx, gc->weak, gc->weak_cap * sizeof(Allocation *));
+  }
+  gc->weak = NULL;
+  gc->nweak = gc->weak_cap = 0;
   gc_allocation_map_delete(gc->allocs);
   return collected;
 }
 
+static void gc_profile_report(GarbageCollector *gc);
+
 size_t gc_run(GarbageCollector *gc) {
   LOG_DEBUG("Initiating GC run (gc@%p)", (void *)gc);
+  gc->collections++;
+  if (gc->trace) {
+    gc_trace(gc, GC_TRACE_COLLECT, 0, NULL);
+  }
   gc_mark(gc);
-  return gc_sweep(gc);
+  size_t total = gc_sweep(gc);
+  if (gc->profile && gc->profile->report) {
+    gc_profile_report(gc);
+  }
+  return total;
 }
 
 char *gc_strdup(GarbageCollector *gc, const char *s) {
@@ -556,3 +1348,138 @@ char *gc_strdup(GarbageCollector *gc, const char *s) {
   }
   return (char *)memcpy(new, s, len);
 }
+
+void gc_profile_start(GarbageCollector *gc, size_t interval, FILE *report) {
+  gc_profile_stop(gc);
+  GCProfile *p = (GCProfile *)gc->metadata.zalloc(gc->metadata.ctx, 1, sizeof(GCProfile));
+  if (!p) {
+    LOG_WARNING("Could not allocate the heap profile%s", "");
+    return;
+  }
+  p->interval = interval ? interval : GC_PROFILE_INTERVAL;
+  p->rng = 0x9E3779B97F4A7C15ull ^ (uintptr_t)gc;
+  p->report = report;
+  gc_profile_reset(p);
+  gc->profile = p;
+}
+
+void gc_profile_label(GarbageCollector *gc, const char *(*label)(void *data), void *data) {
+  if (gc->profile) {
+    gc->profile->label = label;
+    gc->profile->data = data;
+  }
+}
+
+void gc_profile_stop(GarbageCollector *gc) {
+  GCProfile *p = gc->profile;
+  if (!p) {
+    return;
+  }
+  for (size_t i = 0; i < p->samples_cap; ++i) {
+    Allocation *alloc = p->samples[i].ptr ? gc_allocation_map_get(gc->allocs, p->samples[i].ptr) : NULL;
+    if (alloc) {
+      alloc->tag &= ~GC_TAG_SAMPLED;
+    }
+  }
+  if (p->samples) {
+    gc->metadata.free(gc->metadata.ctx, p->samples, p->samples_cap * sizeof(GCSample));
+  }
+  for (size_t i = 0; i < GC_PROFILE_BUCKETS; ++i) {
+    while (p->sites[i]) {
+      GCSite *next = p->sites[i]->next;
+      if (p->sites[i]->label) {
+        gc->metadata.free(gc->metadata.ctx, p->sites[i]->label, strlen(p->sites[i]->label) + 1);
+      }
+      gc->metadata.free(gc->metadata.ctx, p->sites[i], sizeof(GCSite));
+      p->sites[i] = next;
+    }
+  }
+  gc->metadata.free(gc->metadata.ctx, p, sizeof(GCProfile));
+  gc->profile = NULL;
+}
+
+/**
+ * Write the name of a site as a folded stack: the label followed by the C
+ * frames from the outermost to the innermost, separated by semicolons.
+ * Frames are named by `backtrace_symbols`, which only knows the names of
+ * exported functions (link with -rdynamic), other frames are addresses.
+ */
+static void gc_profile_write_site(GCSite *site, FILE *out) {
+  const char *sep = "";
+  if (site->label) {
+    fputs(site->label, out);
+    sep = ";";
+  }
+  char **names = NULL;
+#ifdef GC_HAVE_BACKTRACE
+  names = site->depth ? backtrace_symbols(site->frames, site->depth) : NULL;
+#endif
+  for (int i = site->depth - 1; i >= 0; --i) {
+    const char *name = names ? strchr(names[i], '(') : NULL;
+    size_t len = name ? strcspn(++name, "+)") : 0;
+    if (len) {
+      fprintf(out, "%s%.*s", sep, (int)len, name);
+    } else {
+      fprintf(out, "%s%p", sep, site->frames[i]);
+    }
+    sep = ";";
+  }
+  free(names);
+}
+
+static int gc_profile_by_live(const void *a, const void *b) {
+  size_t x = (*(GCSite *const *)a)->live, y = (*(GCSite *const *)b)->live;
+  return (x < y) - (x > y);
+}
+
+/* Prints the sites with the most live bytes, called after every collection. */
+static void gc_profile_report(GarbageCollector *gc) {
+  GCProfile *p = gc->profile;
+  size_t cap = p->nsites ? p->nsites : 1;
+  GCSite **sites = (GCSite **)gc->metadata.alloc(gc->metadata.ctx, cap * sizeof(GCSite *));
+  if (!sites) {
+    return;
+  }
+  size_t n = 0, live = 0;
+  for (size_t i = 0; i < GC_PROFILE_BUCKETS; ++i) {
+    for (GCSite *site = p->sites[i]; site; site = site->next) {
+      sites[n++] = site;
+      live += site->live;
+    }
+  }
+  qsort(sites, n, sizeof(GCSite *), gc_profile_by_live);
+  fprintf(p->report, "gc profile: %zu sites, %zu bytes live (estimated)\n", n, live);
+  for (size_t i = 0; i < n && i < GC_PROFILE_TOP && sites[i]->live; ++i) {
+    fprintf(p->report, "%12zu live %12zu total  ", sites[i]->live, sites[i]->total);
+    gc_profile_write_site(sites[i], p->report);
+    fputc('\n', p->report);
+  }
+  gc->metadata.free(gc->metadata.ctx, sites, cap * sizeof(GCSite *));
+}
+
+bool gc_profile_write(GarbageCollector *gc, FILE *out, bool live) {
+  if (!gc->profile) {
+    return false;
+  }
+  for (size_t i = 0; i < GC_PROFILE_BUCKETS; ++i) {
+    for (GCSite *site = gc->profile->sites[i]; site; site = site->next) {
+      size_t bytes = live ? site->live : site->total;
+      if (bytes) {
+        gc_profile_write_site(site, out);
+        fprintf(out, " %zu\n", bytes);
+      }
+    }
+  }
+  return !ferror(out);
+}
+
+bool gc_trace_start(GarbageCollector *gc, FILE *out) {
+  gc->trace = out;
+  return fwrite(GC_TRACE_MAGIC, 1, sizeof(GC_TRACE_MAGIC) - 1, out) == sizeof(GC_TRACE_MAGIC) - 1;
+}
+
+bool gc_trace_stop(GarbageCollector *gc) {
+  FILE *out = gc->trace;
+  gc->trace = NULL;
+  return !out || (fflush(out) == 0 && !ferror(out));
+}
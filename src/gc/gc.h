@@ -7,14 +7,51 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 struct AllocationMap;
+struct GCProfile;
+
+/*
+ * A backing allocator: the collector takes payload memory and its own
+ * metadata from allocators like this one, both default to malloc and
+ * friends. `free` and `realloc` are passed the size of the block. Failing
+ * calls return NULL and should set errno to ENOMEM.
+ */
+typedef struct GCAllocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*zalloc)(void *ctx, size_t count, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} GCAllocator;
+
+extern const GCAllocator gc_system_allocator;
 
 typedef struct GarbageCollector {
   struct AllocationMap *allocs; // allocation map
   bool paused;                  // (temporarily) switch gc on/off
   void *bos;                    // bottom of stack
   size_t min_size;
+  struct GCProfile *profile; // heap profile, NULL unless sampling
+  size_t large_size;         // allocations of this size or more are mapped directly, 0 disables
+  bool huge_pages;           // map large objects with transparent huge pages
+  size_t heap_size;          // bytes currently allocated
+  size_t heap_limit;         // maximum of heap_size, 0 is unlimited
+  size_t unreturned;         // bytes swept from the malloc heap since the last scavenge
+  size_t external_size;      // native bytes owned by allocations, see gc_external
+  size_t external_growth;    // native bytes reported since the last collection
+  size_t external_trigger;   // external_growth that makes a collection due
+  GCAllocator payload;       // backing allocator for managed memory
+  GCAllocator metadata;      // backing allocator for the allocation map, root table and profile
+  bool scan_stack;           // conservatively scan the C stack and registers
+  void ***roots;             // registered root slots
+  size_t nroots, roots_cap;
+  struct Allocation **weak;  // weak allocations and ephemerons marked by the running collection
+  size_t nweak, weak_cap;
+  bool weak_overflow;        // `weak` could not grow, the weak passes walk the allocation map
+  size_t collections; // number of collections run
+  FILE *trace;        // allocation trace being recorded, NULL if none
 } GarbageCollector;
 
 extern GarbageCollector gc; // Global garbage collector for all
@@ -24,6 +61,7 @@ extern GarbageCollector gc; // Global garbage collector for all
  * Starting, stopping, pausing, resuming and running the GC.
  */
 void gc_start(GarbageCollector *gc, void *bos);
+void gc_start_alloc(GarbageCollector *gc, void *bos, const GCAllocator *payload, const GCAllocator *metadata);
 void gc_start_ext(GarbageCollector *gc, void *bos, size_t initial_size, size_t min_size, double downsize_load_factor,
                   double upsize_load_factor, double sweep_factor);
 size_t gc_stop(GarbageCollector *gc);
@@ -31,12 +69,85 @@ void gc_pause(GarbageCollector *gc);
 void gc_resume(GarbageCollector *gc);
 size_t gc_run(GarbageCollector *gc);
 
+/*
+ * Allocations of at least `threshold` bytes (GC_LARGE_SIZE by default, 0
+ * disables it) live in a large-object space of their own mappings. Their
+ * pages are returned on sweep and they are resized with mremap. Only
+ * pointer aligned words of large objects are scanned.
+ */
+#define GC_LARGE_SIZE (256 * 1024)
+
+void gc_large_objects(GarbageCollector *gc, size_t threshold, bool huge_pages);
+
+/*
+ * An allocation that would take the heap above its limit triggers a full
+ * collection and fails with ENOMEM if that does not make enough room.
+ * Sweeps return free memory to the system once GC_SCAVENGE_SIZE bytes have
+ * been freed, `gc_scavenge` does so right away.
+ */
+#define GC_SCAVENGE_SIZE (4 * 1024 * 1024)
+
+void gc_heap_limit(GarbageCollector *gc, size_t limit);
+void gc_scavenge(GarbageCollector *gc);
+
+/*
+ * Precise roots. A registered slot keeps whatever it points to alive.
+ * `GC_ROOT(gc, var)` registers the address of a pointer variable for the
+ * rest of the enclosing scope (GCC and Clang only). With stack scanning
+ * disabled, registered slots and static allocations are the only roots and
+ * allocation never triggers a collection, `gc_safepoint` runs a due one
+ * at a point where the caller has registered all live pointers. A heap
+ * limit then fails allocations without an emergency collection, instead
+ * safepoints collect once the heap comes close to the limit. Registering a
+ * slot aborts if the root table cannot grow. `gc_root_mark` returns the
+ * depth of the root table and `gc_root_reset` drops every slot registered
+ * since, e.g. those of GC_ROOT scopes a longjmp left.
+ *
+ * Only code that registers its live pointers may reach a safepoint. The
+ * interpreter in llgc.c registers the state of its evaluator but not the C
+ * locals of builtins, which run with the context pinned (`c->pinned`) and
+ * skip the safepoints of the evaluations they start. Without stack scanning
+ * a builtin therefore never collects while it runs, however much it
+ * allocates: a long-running one grows the heap until it returns or the heap
+ * limit fails it.
+ */
+void gc_add_root(GarbageCollector *gc, void **slot);
+void gc_remove_root(GarbageCollector *gc, void **slot);
+size_t gc_root_mark(GarbageCollector *gc);
+void gc_root_reset(GarbageCollector *gc, size_t mark);
+void gc_scan_stack(GarbageCollector *gc, bool enabled);
+bool gc_safepoint(GarbageCollector *gc);
+
+typedef struct GCRootScope {
+  GarbageCollector *gc;
+  void **slot;
+} GCRootScope;
+
+static inline void gc_root_scope_end(GCRootScope *s) { gc_remove_root(s->gc, s->slot); }
+
+#define GC_ROOT_CAT_(a, b) a##b
+#define GC_ROOT_CAT(a, b) GC_ROOT_CAT_(a, b)
+#define GC_ROOT(gc, var)                                                                                               \
+  __attribute__((cleanup(gc_root_scope_end))) GCRootScope GC_ROOT_CAT(gc_root_, __LINE__) = {                          \
+      (gc_add_root((gc), (void **)&(var)), (gc)), (void **)&(var)}
+
 /*
  * Allocating and deallocating memory.
+ *
+ * Weak allocations are arrays of `count` pointers that do not keep their
+ * targets alive, a slot is set to NULL when its target is collected.
+ * Ephemeron allocations are arrays of `count` (key, value) pointer pairs, a
+ * value is only kept alive while its key is reachable through other paths.
+ * Pairs with a collected key become (GC_CLEARED, NULL).
  */
+#define GC_CLEARED ((void *)1)
+
 void *gc_malloc(GarbageCollector *gc, size_t size);
 void *gc_malloc_static(GarbageCollector *gc, size_t size, void (*dtor)(void *));
 void *gc_malloc_ext(GarbageCollector *gc, size_t size, void (*dtor)(void *));
+void *gc_malloc_atomic(GarbageCollector *gc, size_t size);
+void *gc_calloc_weak(GarbageCollector *gc, size_t count);
+void *gc_calloc_ephemeron(GarbageCollector *gc, size_t count);
 void *gc_calloc(GarbageCollector *gc, size_t count, size_t size);
 void *gc_calloc_ext(GarbageCollector *gc, size_t count, size_t size, void (*dtor)(void *));
 void *gc_realloc(GarbageCollector *gc, void *ptr, size_t size);
@@ -46,6 +157,75 @@ void gc_free(GarbageCollector *gc, void *ptr);
  * Lifecycle management
  */
 void *gc_make_static(GarbageCollector *gc, void *ptr);
+bool gc_owns(GarbageCollector *gc, void *ptr);
+
+/*
+ * External memory. Allocations that own native resources report their
+ * size (and changes to it) with `gc_external`, which makes a collection due
+ * once enough native memory was reported, so that destructors run in time.
+ */
+#define GC_EXTERNAL_TRIGGER (8 * 1024 * 1024)
+
+bool gc_external(GarbageCollector *gc, void *ptr, ptrdiff_t delta);
+
+/*
+ * Sampling heap profiler. About one sample is taken per `interval` bytes
+ * (GC_PROFILE_INTERVAL if 0) and attributed to the C call stack and, if a
+ * label hook is set, the string it returns for the current allocation; the
+ * hook must not allocate from the collector. With a `report` stream the
+ * sites with the most live bytes are printed after every collection.
+ * `gc_profile_write` emits live or cumulative bytes per site in the folded
+ * stack format read by flamegraph.pl and speedscope.
+ */
+#define GC_PROFILE_INTERVAL (512 * 1024)
+
+void gc_profile_start(GarbageCollector *gc, size_t interval, FILE *report);
+void gc_profile_label(GarbageCollector *gc, const char *(*label)(void *data), void *data);
+void gc_profile_stop(GarbageCollector *gc);
+bool gc_profile_write(GarbageCollector *gc, FILE *out, bool live);
+
+/*
+ * Allocation traces for replay with gc_replay. A trace starts with
+ * GC_TRACE_MAGIC, followed by events: an opcode byte and its operands as
+ * unsigned LEB128 numbers. Pointers are recorded divided by the pointer
+ * size.
+ *
+ *   GC_TRACE_ALLOC ptr size kind   allocation of a GC_TRACE_PLAIN, _ATOMIC,
+ *                                  _WEAK or _EPHEMERON object
+ *   GC_TRACE_REALLOC old new size  reallocation
+ *   GC_TRACE_FREE ptr              explicit gc_free
+ *   GC_TRACE_DEAD ptr              swept as unreachable
+ *   GC_TRACE_ROOT ptr              made static
+ *   GC_TRACE_COLLECT               start of a collection
+ *   GC_TRACE_ADD_ROOT slot         slot registered with gc_add_root
+ *   GC_TRACE_REMOVE_ROOT slot      registered slot removed
+ *   GC_TRACE_REACH ptr             reached from a root or the stack
+ *   GC_TRACE_EDGE from to          reached through a reference in `from`
+ *
+ * Every collection records the graph it marks: each reference that leads
+ * to an allocation is recorded as GC_TRACE_REACH or GC_TRACE_EDGE, before
+ * the contents of the allocation are scanned. Edges are recorded for every
+ * collection, so traces grow with the live heap times the number of
+ * collections.
+ */
+#define GC_TRACE_MAGIC "GCTRACE2"
+
+enum {
+  GC_TRACE_ALLOC = 1,
+  GC_TRACE_REALLOC,
+  GC_TRACE_FREE,
+  GC_TRACE_DEAD,
+  GC_TRACE_ROOT,
+  GC_TRACE_COLLECT,
+  GC_TRACE_ADD_ROOT,
+  GC_TRACE_REMOVE_ROOT,
+  GC_TRACE_REACH,
+  GC_TRACE_EDGE
+};
+enum { GC_TRACE_PLAIN, GC_TRACE_ATOMIC, GC_TRACE_WEAK, GC_TRACE_EPHEMERON };
+
+bool gc_trace_start(GarbageCollector *gc, FILE *out);
+bool gc_trace_stop(GarbageCollector *gc);
 
 /*
  * Helper functions and stdlib replacements.
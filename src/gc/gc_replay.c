@@ -0,0 +1,434 @@
+/*
+ * gc_replay - replays an allocation trace recorded with gc_trace_start
+ * against a collector configuration and reports allocation throughput,
+ * collection pauses and peak RSS.
+ *
+ *   cc -O2 -o gc_replay src/gc/gc_replay.c src/gc/gc.c src/gc/log.c -lm
+ *   gc_replay TRACE [INITIAL_SIZE MIN_SIZE DOWNSIZE_FACTOR UPSIZE_FACTOR SWEEP_FACTOR]
+ *
+ * The configuration arguments are those of gc_start_ext and default to the
+ * ones of gc_start. Every recorded collection rebuilds the object graph it
+ * marked: objects it reached from a root or the stack are rooted, and each
+ * reference between two objects is written into the replayed object that
+ * holds it, so the replayed collector marks a heap of the recorded shape.
+ * References that do not fit into their object, or that come from objects
+ * allocated before the recording, root their target instead. New objects
+ * stay rooted until the next recorded collection. Whatever was alive in the
+ * recording stays reachable in the replay, so a configuration can collect
+ * later than the recorded one but never earlier.
+ *
+ * Recorded collections and their graph are replayed without timing, the
+ * replayed configuration decides when to collect. It collects before an
+ * allocation without scanning the stack of gc_replay, whose stale pointers
+ * would keep dead graphs alive. Root registrations are replayed on slots
+ * of their own, so their cost is measured but they keep nothing alive.
+ * Replay each configuration in a process of its own: the peak RSS is that
+ * of the whole process.
+ */
+#include "gc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define PTRSIZE sizeof(char *)
+
+/*
+ * Maps recorded pointers to slots of the live table. Open addressing with
+ * linear probing; deleted keys become tombstones until the next resize.
+ */
+#define SLOT_EMPTY 0
+#define SLOT_DELETED UINT64_MAX
+
+typedef struct {
+  uint64_t key;
+  size_t slot;
+} SlotEntry;
+
+typedef struct {
+  SlotEntry *entries;
+  size_t cap, used, filled; // filled counts tombstones, too
+} SlotMap;
+
+static size_t slot_hash(uint64_t key) { return (size_t)(key * 0x9E3779B97F4A7C15ull >> 17); }
+
+static SlotEntry *slot_find(SlotMap *m, uint64_t key) {
+  if (!m->cap) {
+    return NULL;
+  }
+  for (size_t i = slot_hash(key) & (m->cap - 1);; i = (i + 1) & (m->cap - 1)) {
+    if (m->entries[i].key == key) {
+      return &m->entries[i];
+    }
+    if (m->entries[i].key == SLOT_EMPTY) {
+      return NULL;
+    }
+  }
+}
+
+static void slot_put(SlotMap *m, uint64_t key, size_t slot) {
+  if ((m->filled + 1) * 4 > m->cap * 3) {
+    SlotMap grown = {calloc(m->cap ? m->cap * 2 : 1024, sizeof(SlotEntry)), m->cap ? m->cap * 2 : 1024, 0, 0};
+    if (!grown.entries) {
+      perror("gc_replay");
+      exit(1);
+    }
+    for (size_t i = 0; i < m->cap; ++i) {
+      if (m->entries[i].key != SLOT_EMPTY && m->entries[i].key != SLOT_DELETED) {
+        slot_put(&grown, m->entries[i].key, m->entries[i].slot);
+      }
+    }
+    free(m->entries);
+    *m = grown;
+  }
+  size_t i = slot_hash(key) & (m->cap - 1);
+  while (m->entries[i].key != SLOT_EMPTY && m->entries[i].key != SLOT_DELETED) {
+    i = (i + 1) & (m->cap - 1);
+  }
+  m->filled += m->entries[i].key == SLOT_EMPTY;
+  m->used++;
+  m->entries[i] = (SlotEntry){key, slot};
+}
+
+static void slot_delete(SlotMap *m, SlotEntry *e) {
+  e->key = SLOT_DELETED;
+  m->used--;
+}
+
+/*
+ * A replayed object. The first `fill` words of a plain object hold the
+ * references the collection `epoch` recorded in it.
+ */
+typedef struct {
+  void *ptr;
+  uint64_t size, kind, epoch;
+  size_t fill;
+} Replayed;
+
+/*
+ * The replayed heap: `objects` holds every replayed object that is still
+ * alive in the recording and `spare` its free slots. `live` is a static
+ * allocation with a slot for each, that roots the object until the next
+ * recorded collection if it is set. `kept` is a static allocation, too, it
+ * holds the references of objects freed or shrunk since the last collection.
+ */
+static GarbageCollector heap;
+static Replayed *objects;
+static void **live;
+static size_t live_cap, live_top;
+static size_t *spare;
+static size_t nspare;
+static void **kept;
+static size_t kept_cap, nkept;
+static uint64_t epoch;
+static SlotMap slots;
+static SlotMap roots; // recorded root slots, mapped to the address of their replayed slot
+
+static size_t live_slot(void) {
+  if (nspare) {
+    return spare[--nspare];
+  }
+  if (live_top == live_cap) {
+    size_t cap = live_cap ? live_cap * 2 : 1024;
+    live = gc_realloc(&heap, live, cap * PTRSIZE);
+    spare = realloc(spare, cap * sizeof(size_t));
+    objects = realloc(objects, cap * sizeof(Replayed));
+    if (!live || !spare || !objects) {
+      perror("gc_replay");
+      exit(1);
+    }
+    memset(live + live_cap, 0, (cap - live_cap) * PTRSIZE);
+    live_cap = cap;
+  }
+  return live_top++;
+}
+
+static void live_release(SlotEntry *e) {
+  live[e->slot] = objects[e->slot].ptr = NULL;
+  spare[nspare++] = e->slot;
+  slot_delete(&slots, e);
+}
+
+/* Starts the edges of `slot` over if they are those of an earlier collection. */
+static void replay_touch(size_t slot) {
+  Replayed *o = &objects[slot];
+  if (o->epoch != epoch) {
+    memset(o->ptr, 0, o->fill * PTRSIZE);
+    o->fill = 0;
+    o->epoch = epoch;
+  }
+}
+
+/* Keeps the references in words `from` to `fill` of `o` reachable until the next collection. */
+static void replay_keep(Replayed *o, size_t from) {
+  for (size_t i = from; i < o->fill; ++i) {
+    if (nkept == kept_cap) {
+      size_t cap = kept_cap ? kept_cap * 2 : 1024;
+      kept = kept ? gc_realloc(&heap, kept, cap * PTRSIZE) : gc_malloc_static(&heap, cap * PTRSIZE, NULL);
+      if (!kept) {
+        perror("gc_replay");
+        exit(1);
+      }
+      memset(kept + kept_cap, 0, (cap - kept_cap) * PTRSIZE);
+      kept_cap = cap;
+    }
+    kept[nkept++] = ((void **)o->ptr)[i];
+  }
+}
+
+static void *replay_alloc(uint64_t size, uint64_t kind) {
+  switch (kind) {
+  case GC_TRACE_ATOMIC:
+    return gc_malloc_atomic(&heap, size);
+  case GC_TRACE_WEAK:
+    return gc_calloc_weak(&heap, size / PTRSIZE);
+  case GC_TRACE_EPHEMERON:
+    return gc_calloc_ephemeron(&heap, size / (2 * PTRSIZE));
+  default:
+    return gc_calloc(&heap, 1, size);
+  }
+}
+
+static bool read_word(FILE *in, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(in);
+    if (c == EOF) {
+      return false;
+    }
+    *v |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 7) {
+    fprintf(stderr, "usage: %s TRACE [INITIAL_SIZE MIN_SIZE DOWNSIZE_FACTOR UPSIZE_FACTOR SWEEP_FACTOR]\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  char magic[sizeof(GC_TRACE_MAGIC) - 1];
+  if (!in || fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, GC_TRACE_MAGIC, sizeof(magic))) {
+    fprintf(stderr, "%s: %s is not an allocation trace\n", argv[0], argv[1]);
+    return 1;
+  }
+  size_t initial_size = 1024, min_size = 1024;
+  double downsize = 0.2, upsize = 0.8, sweep = 0.5;
+  if (argc == 7) {
+    initial_size = strtoul(argv[2], NULL, 0);
+    min_size = strtoul(argv[3], NULL, 0);
+    downsize = strtod(argv[4], NULL);
+    upsize = strtod(argv[5], NULL);
+    sweep = strtod(argv[6], NULL);
+  }
+  gc_start_ext(&heap, &argc, initial_size, min_size, downsize, upsize, sweep);
+  gc_scan_stack(&heap, false);
+  live = gc_malloc_static(&heap, PTRSIZE, NULL);
+
+  size_t counts[GC_TRACE_EDGE + 1] = {0};
+  size_t allocated = 0, npauses = 0, pauses_cap = 0, rooted_edges = 0;
+  uint64_t *pauses = NULL, busy = 0;
+  int op;
+  while ((op = getc(in)) != EOF) {
+    uint64_t a = 0, b = 0, c = 0;
+    bool ok = op >= GC_TRACE_ALLOC && op <= GC_TRACE_EDGE;
+    if (ok && op != GC_TRACE_COLLECT) {
+      ok = read_word(in, &a);
+    }
+    if (ok && op == GC_TRACE_EDGE) {
+      ok = read_word(in, &b);
+    }
+    if (ok && (op == GC_TRACE_ALLOC || op == GC_TRACE_REALLOC)) {
+      ok = read_word(in, &b) && read_word(in, &c);
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: truncated or corrupt trace\n", argv[0]);
+      return 1;
+    }
+    counts[op]++;
+    bool root_op = op == GC_TRACE_ADD_ROOT || op == GC_TRACE_REMOVE_ROOT;
+    SlotEntry *e = op == GC_TRACE_COLLECT ? NULL : slot_find(root_op ? &roots : &slots, a);
+    if (op == GC_TRACE_COLLECT || op == GC_TRACE_REACH || op == GC_TRACE_EDGE) {
+      // rebuild the graph of the recorded collection, no replayed collection can run meanwhile
+      if (op == GC_TRACE_COLLECT) {
+        epoch++;
+        memset(live, 0, live_top * PTRSIZE);
+        if (nkept) {
+          memset(kept, 0, nkept * PTRSIZE);
+          nkept = 0;
+        }
+        continue;
+      }
+      SlotEntry *to = op == GC_TRACE_EDGE ? slot_find(&slots, b) : e;
+      if (!to) {
+        continue; // allocated before the recording
+      }
+      replay_touch(to->slot);
+      Replayed *from = op == GC_TRACE_EDGE && e ? &objects[e->slot] : NULL;
+      if (from && from->kind == GC_TRACE_PLAIN && (from->fill + 1) * PTRSIZE <= from->size) {
+        replay_touch(e->slot);
+        ((void **)from->ptr)[from->fill++] = objects[to->slot].ptr;
+      } else {
+        rooted_edges += op == GC_TRACE_EDGE;
+        live[to->slot] = objects[to->slot].ptr;
+      }
+      continue;
+    }
+    size_t collections = heap.collections;
+    uint64_t start = now_ns();
+    if (op == GC_TRACE_ALLOC || op == GC_TRACE_REALLOC) {
+      gc_safepoint(&heap);
+    }
+    switch (op) {
+    case GC_TRACE_REALLOC:
+      if (e) {
+        Replayed *o = &objects[e->slot];
+        if (o->kind == GC_TRACE_PLAIN && c / PTRSIZE < o->fill) {
+          replay_keep(o, c / PTRSIZE);
+          o->fill = c / PTRSIZE;
+        }
+        void *p = gc_realloc(&heap, o->ptr, c);
+        size_t slot = e->slot;
+        slot_delete(&slots, e);
+        if (p) {
+          if (c > o->size) {
+            memset((char *)p + o->size, 0, c - o->size); // only recorded edges may refer to other objects
+          }
+          live[slot] = o->ptr = p;
+          o->size = c;
+          slot_put(&slots, b, slot);
+        } else {
+          live[slot] = o->ptr = NULL;
+          spare[nspare++] = slot;
+        }
+        allocated += c;
+        break;
+      }
+      // reallocation of an object from before the recording, replay as allocation
+      a = b;
+      b = c;
+      c = GC_TRACE_PLAIN;
+      e = slot_find(&slots, a);
+      // fallthrough
+    case GC_TRACE_ALLOC: {
+      if (e) {
+        // the address was reused for an object whose death was not recorded
+        live_release(e);
+      }
+      size_t slot = live_slot();
+      live[slot] = replay_alloc(b, c);
+      objects[slot] = (Replayed){live[slot], b, c, epoch, 0};
+      if (live[slot]) {
+        slot_put(&slots, a, slot);
+      } else {
+        spare[nspare++] = slot;
+      }
+      allocated += b;
+      break;
+    }
+    case GC_TRACE_FREE:
+      if (e) {
+        // what the object referred to may still be reachable in the recording
+        if (objects[e->slot].kind == GC_TRACE_PLAIN) {
+          replay_keep(&objects[e->slot], 0);
+        }
+        gc_free(&heap, objects[e->slot].ptr);
+        live_release(e);
+      }
+      break;
+    case GC_TRACE_DEAD:
+      if (e) {
+        live_release(e);
+      }
+      break;
+    case GC_TRACE_ROOT:
+      if (e) {
+        gc_make_static(&heap, objects[e->slot].ptr);
+      }
+      break;
+    case GC_TRACE_ADD_ROOT: {
+      void **slot = calloc(1, PTRSIZE);
+      if (!slot) {
+        perror("gc_replay");
+        return 1;
+      }
+      gc_add_root(&heap, slot);
+      slot_put(&roots, a, (size_t)(uintptr_t)slot);
+      break;
+    }
+    case GC_TRACE_REMOVE_ROOT:
+      if (e) {
+        gc_remove_root(&heap, (void **)(uintptr_t)e->slot);
+        free((void *)(uintptr_t)e->slot);
+        slot_delete(&roots, e);
+      }
+      break;
+    }
+    uint64_t elapsed = now_ns() - start;
+    busy += elapsed;
+    if (heap.collections != collections) {
+      if (npauses == pauses_cap) {
+        pauses_cap = pauses_cap ? pauses_cap * 2 : 256;
+        pauses = realloc(pauses, pauses_cap * sizeof(uint64_t));
+        if (!pauses) {
+          perror("gc_replay");
+          return 1;
+        }
+      }
+      pauses[npauses++] = elapsed;
+    }
+  }
+  fclose(in);
+
+  size_t events = 0;
+  for (int i = GC_TRACE_ALLOC; i <= GC_TRACE_REMOVE_ROOT; ++i) {
+    events += i == GC_TRACE_COLLECT ? 0 : counts[i];
+  }
+  uint64_t paused = 0;
+  for (size_t i = 0; i < npauses; ++i) {
+    paused += pauses[i];
+  }
+  qsort(pauses, npauses, sizeof(uint64_t), compare_u64);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("config      %zu %zu %g %g %g\n", initial_size, min_size, downsize, upsize, sweep);
+  printf("events      %zu (%zu alloc, %zu realloc, %zu free, %zu dead, %zu root, %zu recorded collections)\n", events,
+         counts[GC_TRACE_ALLOC], counts[GC_TRACE_REALLOC], counts[GC_TRACE_FREE], counts[GC_TRACE_DEAD],
+         counts[GC_TRACE_ROOT], counts[GC_TRACE_COLLECT]);
+  printf("roots       %zu registered, %zu removed\n", counts[GC_TRACE_ADD_ROOT], counts[GC_TRACE_REMOVE_ROOT]);
+  printf("graph       %zu reached from roots, %zu edges (%zu replayed as roots)\n", counts[GC_TRACE_REACH],
+         counts[GC_TRACE_EDGE], rooted_edges);
+  printf("time        %.3f ms, %.0f events/s, %.1f MB/s allocated\n", busy / 1e6, busy ? events * 1e9 / busy : 0.0,
+         busy ? allocated * 1e3 / busy : 0.0);
+  printf("collections %zu, %.3f ms paused (%.1f%%)\n", npauses, paused / 1e6, busy ? 100.0 * paused / busy : 0.0);
+  if (npauses) {
+    printf("pauses      p50 %.1f us, p99 %.1f us, max %.1f us\n", pauses[npauses / 2] / 1e3,
+           pauses[npauses * 99 / 100] / 1e3, pauses[npauses - 1] / 1e3);
+  }
+  printf("live        %zu objects at the end of the trace\n", slots.used);
+  printf("peak rss    %ld KiB\n", usage.ru_maxrss);
+  free(pauses);
+  free(spare);
+  free(objects);
+  free(slots.entries);
+  gc_stop(&heap);
+  return 0;
+}
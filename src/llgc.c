@@ -1,13 +1,51 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "gc/gc.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* The collector objects are allocated from, threads running `pmap` workers allocate from private ones. */
+static __thread GarbageCollector *ll_heap = &gc;
+
+/*
+ * Allocation failure, e.g. at the heap limit. Interpreter allocations are checked by `ll_checked`, which unwinds to
+ * the outermost evaluation of the thread: that evaluation reports "out of memory" and returns NULL. Outside of an
+ * evaluation there is nothing to unwind to and the process aborts.
+ */
+static __thread jmp_buf *ll_failure;
+
+static void ll_out_of_memory(void) {
+  if (ll_failure)
+    longjmp(*ll_failure, 1);
+  fprintf(stderr, "out of memory\n");
+  abort();
+}
+
+static void *ll_checked(void *p) {
+  if (!p)
+    ll_out_of_memory();
+  return p;
+}
+
 typedef unsigned int Location;
 
 static inline Location l_create(unsigned short line, unsigned short column) {
@@ -44,6 +82,16 @@ typedef enum DataType {
   D_Float = 15,
   D_CData = 17,
   D_CFunc = 19,
+  D_Code = 21,
+  D_Vector = 23,
+  D_I64Array = 25,
+  D_F64Array = 27,
+  D_Closure = 29,
+  D_Continuation = 31,
+  D_Builder = 33,
+  D_Table = 35,
+  D_Weak = 37,
+  D_OwnedCData = 39,
 } DataType;
 
 void test_DataType() {
@@ -59,6 +107,16 @@ void test_DataType() {
   assert((D_Int & 1) == 1);
   assert((D_Float & 1) == 1);
   assert((D_CFunc & 1) == 1);
+  assert((D_Code & 1) == 1);
+  assert((D_Vector & 1) == 1);
+  assert((D_I64Array & 1) == 1);
+  assert((D_F64Array & 1) == 1);
+  assert((D_Closure & 1) == 1);
+  assert((D_Continuation & 1) == 1);
+  assert((D_Builder & 1) == 1);
+  assert((D_Table & 1) == 1);
+  assert((D_Weak & 1) == 1);
+  assert((D_OwnedCData & 1) == 1);
 
   printf("%s\n", "ok");
 }
@@ -81,45 +139,74 @@ typedef union Data {
 
 typedef struct Object {
   Data car, cdr;
-  Location location;
 } Object;
 
+typedef struct Frame Frame;
+
 typedef struct Context {
   Object *defined_symbols;
+  Frame *stack; // continuation stack of the evaluator
+  size_t depth, stack_cap;
+  Object *form; // call being evaluated, labels the samples of the heap profiler
+  size_t pinned; // C frames holding unregistered objects across an evaluation, see ll_eval_loop
+  Object *optimized; // weak table of the forms processed by ll_optimize
+  void *snapshot;    // block holding the objects of a restored snapshot, released with the context
 } Context;
 
-static inline Object *ll_malloc(Context *c, DataType dt) {
-  Object *o = (Object *)gc_malloc(&gc, sizeof(Object));
+static inline Object *ll_malloc_ext(Context *c, DataType dt, void (*dtor)(void *)) {
+  Object *o = (Object *)ll_checked(gc_malloc_ext(ll_heap, sizeof(Object), dtor));
   o->car.dt = dt;
   return o;
 }
-static inline DataType ll_type_internal(Object *o) { return !o ? D_Nil : ((o->car.dt & 1) ? o->car.dt : D_List); }
+static inline Object *ll_malloc(Context *c, DataType dt) { return ll_malloc_ext(c, dt, NULL); }
+/*
+ * Immediates. Objects are at least pointer aligned, so the low bits of an Object pointer are free to encode values
+ * that need no allocation at all: low bits 10 mark a fixnum (the integer shifted left by two), 0x4 and 0xC are false
+ * and true. The lowest bit stays clear, so an immediate in the car of a list is never taken for a DataType tag.
+ * Integers outside of the fixnum range are still boxed as D_Int objects.
+ */
+#define LL_FALSE ((Object *)(uintptr_t)0x4)
+#define LL_TRUE ((Object *)(uintptr_t)0xC)
+#define LL_FIXNUM_MAX (LLONG_MAX >> 2)
+#define LL_FIXNUM_MIN (LLONG_MIN >> 2)
+
+static inline bool ll_immediate(Object *o) { return ((uintptr_t)o & 7) != 0; }
+static inline bool ll_fixnum(Object *o) { return ((uintptr_t)o & 3) == 2; }
+
+static inline DataType ll_type_internal(Object *o) {
+  if (ll_immediate(o))
+    return ll_fixnum(o) ? D_Int : D_Bool;
+  return !o ? D_Nil : ((o->car.dt & 1) ? o->car.dt : D_List);
+}
 static inline DataType ll_type(Object *o) {
   DataType dt = ll_type_internal(o);
   if (dt == D_LongSymbol)
     return D_Symbol;
   if (dt == D_LongString)
     return D_String;
+  if (dt == D_OwnedCData)
+    return D_CData;
   return dt;
 }
 
 Object *ll_bool(Context *c, bool v) {
-  Object *o = ll_malloc(c, D_Bool);
-  o->cdr.b = v;
-  return o;
+  (void)c;
+  return v ? LL_TRUE : LL_FALSE;
 }
 bool ll_to_bool(Object *o) {
   assert(ll_type(o) == D_Bool);
-  return o->cdr.b;
+  return ll_immediate(o) ? o == LL_TRUE : o->cdr.b;
 }
 Object *ll_int(Context *c, long long v) {
+  if (v >= LL_FIXNUM_MIN && v <= LL_FIXNUM_MAX)
+    return (Object *)(((uintptr_t)v << 2) | 2);
   Object *o = ll_malloc(c, D_Int);
   o->cdr.i = v;
   return o;
 }
 long long ll_to_int(Object *o) {
   assert(ll_type(o) == D_Int);
-  return o->cdr.i;
+  return ll_fixnum(o) ? (long long)((intptr_t)o >> 2) : o->cdr.i;
 }
 Object *ll_float(Context *c, double v) {
   Object *o = ll_malloc(c, D_Float);
@@ -130,16 +217,22 @@ double ll_to_float(Object *o) {
   assert(ll_type(o) == D_Float);
   return o->cdr.f;
 }
-void ll_set_text_(Object *o, const char *b, size_t l) {
+/* Makes room for a text of `l` characters in `o` and returns it, the terminator is already in place. */
+char *ll_text_room_(Object *o, size_t l) {
+  char *t;
   if (l > 7) {
-    o->cdr.lt = (char *)gc_malloc(&gc, l + 1);
-    memcpy(o->cdr.lt, b, l);
-    o->cdr.lt[l] = '\0';
+    t = o->cdr.lt = (char *)ll_checked(gc_malloc_atomic(ll_heap, l + 1));
   } else {
     o->cdr.ob = NULL;
-    memcpy(o->cdr.t, b, l);
-    o->cdr.t[l] = '\0';
+    t = o->cdr.t;
   }
+  t[l] = '\0';
+  return t;
+}
+void ll_set_text_(Object *o, const char *b, size_t l) {
+  char *t = ll_text_room_(o, l);
+  if (l)
+    memcpy(t, b, l);
 }
 Object *ll_symbol_view(Context *c, const char *b, const char *e) {
   size_t l = e - b;
@@ -176,6 +269,35 @@ void *ll_to_cdata(Object *o) {
   assert(ll_type(o) == D_CData);
   return o->cdr.cd;
 }
+
+/*
+ * Owned native data: the object is followed by the destructor of its resource, which runs when the object is
+ * collected, and the size of the resource is accounted to the heap so that large resources make collections due in
+ * time. Owned data is a CData to everything but `ll_type_internal`, it must not escape a pmap worker, the heap of a
+ * worker is destroyed with everything it owns.
+ */
+typedef void (*CDataDtor)(void *);
+
+static void ll_cdata_release(void *p) {
+  Object *o = (Object *)p;
+  (*(CDataDtor *)(o + 1))(o->cdr.cd);
+}
+
+Object *ll_cdata_ext(Context *c, void *v, size_t size, CDataDtor dtor) {
+  size_t bytes = sizeof(Object) + sizeof(CDataDtor);
+  Object *o = (Object *)ll_checked(gc_malloc_ext(ll_heap, bytes, dtor ? ll_cdata_release : NULL));
+  o->car.dt = D_OwnedCData;
+  o->cdr.cd = v;
+  *(CDataDtor *)(o + 1) = dtor;
+  gc_external(ll_heap, o, (ptrdiff_t)size);
+  return o;
+}
+
+/* Reports that the resource of `o` grew or shrank by `delta` bytes. */
+void ll_cdata_resize(Object *o, ptrdiff_t delta) {
+  assert(ll_type(o) == D_CData);
+  gc_external(ll_heap, o, delta);
+}
 Object *ll_cfunc(Context *c, CFunc v) {
   Object *o = ll_malloc(c, D_CFunc);
   o->cdr.fn = v;
@@ -201,6 +323,124 @@ Object *ll_list(Context *c, int n, Object **objs) {
   return o;
 }
 
+/* A closure pairs its (lambda (params...) body...) form with the environment it was created in. */
+Object *ll_closure(Context *c, Object *lambda, Object *env) {
+  Object *o = ll_malloc(c, D_Closure);
+  o->cdr.ob = ll_cons(c, lambda, env);
+  return o;
+}
+
+/*
+ * Vectors keep their elements in one length prefixed array, so indexing is O(1) and iteration walks contiguous
+ * memory instead of a cons spine. The array is a separate allocation of pointers and immediates only.
+ */
+typedef struct Vector {
+  size_t size;
+  Object *items[];
+} Vector;
+
+Object *ll_vector(Context *c, size_t n) {
+  Vector *v = (Vector *)ll_checked(gc_calloc(ll_heap, 1, sizeof(Vector) + n * sizeof(Object *)));
+  v->size = n;
+  Object *o = ll_malloc(c, D_Vector);
+  o->cdr.cd = v;
+  return o;
+}
+
+Vector *ll_to_vector(Object *o) {
+  assert(ll_type(o) == D_Vector);
+  return (Vector *)o->cdr.cd;
+}
+
+/*
+ * Numeric arrays keep unboxed 64 bit integers or doubles behind a length header. The body is allocated atomic, the
+ * collector neither scans it nor mistakes its numbers for pointers.
+ */
+typedef struct Array {
+  size_t size;
+} Array;
+
+Object *ll_array(Context *c, DataType dt, size_t n) {
+  assert(dt == D_I64Array || dt == D_F64Array);
+  Array *a = (Array *)ll_checked(gc_malloc_atomic(ll_heap, sizeof(Array) + n * sizeof(double)));
+  memset(a, 0, sizeof(Array) + n * sizeof(double));
+  a->size = n;
+  Object *o = ll_malloc(c, dt);
+  o->cdr.cd = a;
+  return o;
+}
+
+Array *ll_to_array(Object *o) {
+  assert(ll_type(o) == D_I64Array || ll_type(o) == D_F64Array);
+  return (Array *)o->cdr.cd;
+}
+
+long long *ll_i64s(Object *o) {
+  assert(ll_type(o) == D_I64Array);
+  return (long long *)(ll_to_array(o) + 1);
+}
+
+double *ll_f64s(Object *o) {
+  assert(ll_type(o) == D_F64Array);
+  return (double *)(ll_to_array(o) + 1);
+}
+
+/*
+ * String builders append into one atomic buffer that doubles when it is full, so a string built from n pieces costs
+ * O(n) copies instead of copying the whole prefix on every concatenation. The contents are flattened into a string
+ * only on demand, that string is kept until the next append.
+ */
+typedef struct Builder {
+  size_t size, cap;
+  char *text;
+  Object *flat;
+} Builder;
+
+Object *ll_builder(Context *c) {
+  Object *o = ll_malloc(c, D_Builder);
+  o->cdr.cd = ll_checked(gc_calloc(ll_heap, 1, sizeof(Builder)));
+  return o;
+}
+
+Builder *ll_to_builder(Object *o) {
+  assert(ll_type(o) == D_Builder);
+  return (Builder *)o->cdr.cd;
+}
+
+/* Makes room for `l` more characters, growing the buffer in place where the allocator can. */
+void ll_builder_reserve(Object *o, size_t l) {
+  Builder *b = ll_to_builder(o);
+  if (b->size + l + 1 > b->cap) {
+    size_t cap = b->cap ? b->cap : 64;
+    while (cap < b->size + l + 1)
+      cap *= 2;
+    b->text = (char *)ll_checked(b->text ? gc_realloc(ll_heap, b->text, cap) : gc_malloc_atomic(ll_heap, cap));
+    b->cap = cap;
+  }
+}
+
+void ll_builder_append(Object *o, const char *t, size_t l) {
+  Builder *b = ll_to_builder(o);
+  // appending the builder's own text, which growing can move
+  bool own = b->text && t >= b->text && t < b->text + b->cap;
+  size_t at = own ? (size_t)(t - b->text) : 0;
+  ll_builder_reserve(o, l);
+  if (own)
+    t = b->text + at;
+  if (l)
+    memcpy(b->text + b->size, t, l);
+  b->size += l;
+  b->text[b->size] = '\0';
+  b->flat = NULL;
+}
+
+Object *ll_builder_string(Context *c, Object *o) {
+  Builder *b = ll_to_builder(o);
+  if (!b->flat)
+    b->flat = ll_string_view(c, b->text, b->text + b->size);
+  return b->flat;
+}
+
 Object *ll_car(Object *o) {
   assert(ll_type(o) == D_List);
   return o->car.ob;
@@ -228,13 +468,14 @@ void test_object_atoms() {
   printf("%s...", __FUNCTION__);
 
   assert(sizeof(Data) == 8);
-  assert(sizeof(Object) == 24);
+  assert(sizeof(Object) == 16);
 
   Context c;
 
   Object *o = ll_bool(&c, true);
   assert(ll_type(o) == D_Bool);
   assert(ll_to_bool(o));
+  assert(o == ll_bool(&c, true));
 
   o = ll_bool(&c, false);
   assert(ll_type(o) == D_Bool);
@@ -243,6 +484,18 @@ void test_object_atoms() {
   o = ll_int(&c, 42);
   assert(ll_type(o) == D_Int);
   assert(ll_to_int(o) == 42);
+  assert(o == ll_int(&c, 42));
+
+  o = ll_int(&c, -7);
+  assert(ll_type(o) == D_Int && ll_immediate(o));
+  assert(ll_to_int(o) == -7);
+
+  long long extremes[] = {LL_FIXNUM_MIN, LL_FIXNUM_MAX, LL_FIXNUM_MIN - 1, LL_FIXNUM_MAX + 1, LLONG_MIN, LLONG_MAX};
+  for (int i = 0; i < 6; ++i) {
+    o = ll_int(&c, extremes[i]);
+    assert(ll_type(o) == D_Int && ll_immediate(o) == (i < 2));
+    assert(ll_to_int(o) == extremes[i]);
+  }
 
   o = ll_float(&c, 4.2);
   assert(ll_type(o) == D_Float);
@@ -311,6 +564,31 @@ void test_object_list_creation() {
   printf("%s\n", "ok");
 }
 
+void test_object_vectors() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+
+  Object *o = ll_vector(&c, 0);
+  assert(ll_type(o) == D_Vector);
+  assert(ll_to_vector(o)->size == 0);
+
+  o = ll_vector(&c, 3);
+  Vector *v = ll_to_vector(o);
+  assert(v->size == 3 && !v->items[0] && !v->items[1] && !v->items[2]);
+  v->items[1] = ll_int(&c, 42);
+  assert(ll_to_int(ll_to_vector(o)->items[1]) == 42);
+
+  o = ll_array(&c, D_F64Array, 5);
+  assert(ll_type(o) == D_F64Array && ll_to_array(o)->size == 5 && ll_f64s(o)[4] == 0.0);
+  ll_f64s(o)[2] = 2.5;
+  assert(ll_f64s(o)[2] == 2.5);
+  o = ll_array(&c, D_I64Array, 0);
+  assert(ll_type(o) == D_I64Array && ll_to_array(o)->size == 0);
+
+  printf("%s\n", "ok");
+}
+
 void test_object_list_interaction() {
   printf("%s...", __FUNCTION__);
 
@@ -343,56 +621,386 @@ void test_object_list_interaction() {
   printf("%s\n", "ok");
 }
 
-Object *ll_read(Context *c, const char *t, const char **end) {
-  Object *o = NULL;
+/*
+ * Lexer helpers. Characters are classified once through a lookup table, the hot scanning loops (whitespace runs,
+ * atoms and string bodies) test 16 (SSE2) or 32 (AVX2) bytes per step. Vector loads are aligned, so they never cross
+ * a page boundary and may safely look at bytes behind the terminating '\0'. That over-read is intentional, the
+ * scanners are therefore excluded from AddressSanitizer, which would report it.
+ *
+ * Reading is bound by allocation, not by scanning: tokenizing the source of the `reader` benchmark runs at about
+ * 300 MB/s, creating its objects (one collector allocation each) brings the whole read down to about 30 MB/s.
+ */
+#define LL_NO_ASAN __attribute__((no_sanitize_address))
+enum { C_SPACE = 1, C_DELIM = 2, C_QUOTE = 4, C_ESCAPE = 8 };
+
+static const unsigned char ll_char_class[256] = {
+    ['\0'] = C_DELIM, [' '] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_SPACE, ['\v'] = C_SPACE,
+    ['\f'] = C_SPACE, ['\r'] = C_SPACE, ['('] = C_DELIM, [')'] = C_DELIM, ['['] = C_DELIM,
+    [']'] = C_DELIM,  ['"'] = C_QUOTE,  ['\\'] = C_ESCAPE,
+};
+
+#if defined(__AVX2__)
+typedef __m256i ll_block;
+#define LL_BLOCK 32
+#define LL_BLOCK_BITS 0xFFFFFFFFu
+LL_NO_ASAN static inline ll_block ll_load(const char *p) { return _mm256_load_si256((const ll_block *)p); }
+static inline unsigned ll_eq(ll_block v, char x) {
+  return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(x)));
+}
+static inline unsigned ll_space(ll_block v) {
+  ll_block ctl =
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(8)), _mm256_cmpgt_epi8(_mm256_set1_epi8(14), v));
+  return (unsigned)_mm256_movemask_epi8(ctl) | ll_eq(v, ' ');
+}
+#elif defined(__SSE2__)
+typedef __m128i ll_block;
+#define LL_BLOCK 16
+#define LL_BLOCK_BITS 0xFFFFu
+LL_NO_ASAN static inline ll_block ll_load(const char *p) { return _mm_load_si128((const ll_block *)p); }
+static inline unsigned ll_eq(ll_block v, char x) {
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(x)));
+}
+static inline unsigned ll_space(ll_block v) {
+  ll_block ctl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(8)), _mm_cmplt_epi8(v, _mm_set1_epi8(14)));
+  return (unsigned)_mm_movemask_epi8(ctl) | ll_eq(v, ' ');
+}
+#endif
+
+#ifdef LL_BLOCK
+/* Bit mask of the block bytes in front of `t`, those must be ignored. */
+static inline unsigned ll_block_head(const char *t) { return (1u << ((uintptr_t)t % LL_BLOCK)) - 1u; }
+static inline const char *ll_block_of(const char *t) {
+  return (const char *)((uintptr_t)t & ~(uintptr_t)(LL_BLOCK - 1));
+}
+#endif
+
+LL_NO_ASAN static const char *ll_skip_space(const char *t) {
+  if (ll_char_class[(unsigned char)*t] != C_SPACE)
+    return t;
+#ifdef LL_BLOCK
+  const char *b = ll_block_of(t);
+  unsigned m = ~ll_space(ll_load(b)) & LL_BLOCK_BITS & ~ll_block_head(t);
+  while (!m) {
+    b += LL_BLOCK;
+    m = ~ll_space(ll_load(b)) & LL_BLOCK_BITS;
+  }
+  return b + __builtin_ctz(m);
+#else
+  while (ll_char_class[(unsigned char)*t] == C_SPACE)
+    ++t;
+  return t;
+#endif
+}
+
+#ifdef LL_BLOCK
+static inline unsigned ll_atom_end(ll_block v) {
+  return ll_space(v) | ll_eq(v, '(') | ll_eq(v, ')') | ll_eq(v, '[') | ll_eq(v, ']') | ll_eq(v, '\0');
+}
+#endif
+
+LL_NO_ASAN static const char *ll_scan_atom(const char *t) {
+#ifdef LL_BLOCK
+  const char *b = ll_block_of(t);
+  unsigned m = ll_atom_end(ll_load(b)) & ~ll_block_head(t);
+  while (!m) {
+    b += LL_BLOCK;
+    m = ll_atom_end(ll_load(b));
+  }
+  return b + __builtin_ctz(m);
+#else
+  while (!(ll_char_class[(unsigned char)*t] & (C_SPACE | C_DELIM)))
+    ++t;
+  return t;
+#endif
+}
+
+/*
+ * Returns the position of the closing '"' (or the terminating '\0') of a string whose body starts at `t`, `*escaped`
+ * is set if the body contains an escape.
+ */
+LL_NO_ASAN static const char *ll_scan_string(const char *t, bool *escaped) {
+  for (;;) {
+#ifdef LL_BLOCK
+    const char *b = ll_block_of(t);
+    ll_block v = ll_load(b);
+    unsigned m = (ll_eq(v, '"') | ll_eq(v, '\\') | ll_eq(v, '\0')) & ~ll_block_head(t);
+    while (!m) {
+      b += LL_BLOCK;
+      v = ll_load(b);
+      m = ll_eq(v, '"') | ll_eq(v, '\\') | ll_eq(v, '\0');
+    }
+    t = b + __builtin_ctz(m);
+#else
+    while (!(ll_char_class[(unsigned char)*t] & (C_QUOTE | C_ESCAPE)) && *t)
+      ++t;
+#endif
+    if (*t != '\\')
+      return t;
+    *escaped = true;
+    if (*++t)
+      ++t;
+  }
+}
+
+/* Creates the string of the body [b, e) with its escapes decoded, \n, \t and \r are control characters. */
+static Object *ll_string_unescape(Context *c, const char *b, const char *e) {
+  size_t l = 0;
+  for (const char *p = b; p < e; ++p, ++l)
+    p += *p == '\\' && p + 1 < e;
+  Object *o = ll_malloc(c, l > 7 ? D_LongString : D_String);
+  char *t = ll_text_room_(o, l);
+  while (b < e) {
+    char ch = *b++;
+    if (ch == '\\' && b < e) {
+      ch = *b++;
+      ch = ch == 'n' ? '\n' : ch == 't' ? '\t' : ch == 'r' ? '\r' : ch;
+    }
+    *t++ = ch;
+  }
+  return o;
+}
+
+static const double ll_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-  while (*t && isspace(*t))
+/*
+ * Number fast path for the token [s, e). Plain decimal integers are converted directly, decimals and exponents are
+ * converted exactly as long as mantissa and exponent are small (mantissa * 10^exp is then correctly rounded), all
+ * other numeric tokens fall back to a single `strtod`. Returns D_Int, D_Float or D_Symbol for non-numbers.
+ */
+static DataType ll_parse_number(const char *s, const char *e, long long *i, double *f) {
+  const char *t = s;
+  bool neg = *t == '-';
+  if (*t == '-' || *t == '+')
     ++t;
+  if (!(t < e && (isdigit((unsigned char)*t) || (*t == '.' && t + 1 < e && isdigit((unsigned char)t[1])))))
+    return D_Symbol;
+
+  unsigned long long m = 0;
+  int digits = 0, exp = 0;
+  for (; t < e && isdigit((unsigned char)*t); ++t, ++digits)
+    m = m * 10 + (unsigned long long)(*t - '0');
+  if (t == e && digits <= 19 && m <= (unsigned long long)LLONG_MAX + neg) {
+    *i = neg ? (long long)(0ull - m) : (long long)m; // -(long long)m overflows for LLONG_MIN
+    return D_Int;
+  }
+  if (t < e && *t == '.')
+    for (++t; t < e && isdigit((unsigned char)*t); ++t, ++digits, --exp)
+      m = m * 10 + (unsigned long long)(*t - '0');
+  if (t < e && (*t == 'e' || *t == 'E')) {
+    const char *x = t + 1;
+    bool eneg = x < e && *x == '-';
+    if (x < e && (*x == '-' || *x == '+'))
+      ++x;
+    int ev = 0;
+    const char *xs = x;
+    for (; x < e && isdigit((unsigned char)*x) && ev < 10000; ++x)
+      ev = ev * 10 + (*x - '0');
+    if (x == xs)
+      return D_Symbol;
+    exp += eneg ? -ev : ev;
+    t = x;
+  }
+  if (t == e && digits <= 15 && exp >= -22 && exp <= 22) {
+    double d = (double)m;
+    d = exp < 0 ? d / ll_pow10[-exp] : d * ll_pow10[exp];
+    *f = neg ? -d : d;
+    return D_Float;
+  }
+  char *end = NULL;
+  *f = strtod(s, &end);
+  return end == e ? D_Float : D_Symbol;
+}
+
+/*
+ * Source locations. Only forms read from text have a location, so instead of a field in every Object they live in a
+ * side table keyed by the address of a list's first cons. Keys are stored complemented, which keeps the conservative
+ * collector from seeing them, and the destructor of a located cons removes its entry when the cons is collected.
+ */
+/*
+ * Call site caches live next to the locations: a located list is a call site when evaluated, its entry remembers the
+ * global binding its operator resolved to. Bindings keep their identity while a context lives (redefinition updates
+ * the value in place), so an entry stays valid until its context is reinitialized, freed or restored, which bumps
+ * `ll_globals_version`. Redefining a builtin bumps it too, as forms processed by `ll_optimize` hold builtins directly.
+ * Entries are dropped with their cons by `ll_location_forget`.
+ */
+typedef struct CallCache {
+  Context *c;
+  Object *binding;
+  size_t version;
+} CallCache;
+
+static size_t ll_globals_version = 1;
+
+typedef struct LocationTable {
+  uintptr_t *keys; // ~address, 0 is empty, LL_LOCATION_GONE a removed entry
+  Location *locations;
+  CallCache *calls;
+  size_t used, cap;
+} LocationTable;
+
+#define LL_LOCATION_GONE ((uintptr_t)1)
+
+static LocationTable ll_locations;
+
+static size_t ll_location_slot(uintptr_t key, size_t cap) {
+  return (size_t)((key >> 3) * 0x9E3779B97F4A7C15ull) & (cap - 1);
+}
+
+static void ll_location_forget(void *o) {
+  uintptr_t key = ~(uintptr_t)o;
+  if (!ll_locations.cap)
+    return;
+  for (size_t i = ll_location_slot(key, ll_locations.cap); ll_locations.keys[i]; i = (i + 1) & (ll_locations.cap - 1))
+    if (ll_locations.keys[i] == key) {
+      ll_locations.keys[i] = LL_LOCATION_GONE;
+      return;
+    }
+}
+
+static void ll_location_set(Object *o, Location l) {
+  LocationTable *t = &ll_locations;
+  if (2 * (t->used + 1) > t->cap) {
+    LocationTable old = *t;
+    size_t live = 0;
+    for (size_t i = 0; i < old.cap; ++i)
+      live += old.keys[i] > LL_LOCATION_GONE;
+    for (t->cap = 256; t->cap < 4 * (live + 1);)
+      t->cap *= 2;
+    t->keys = (uintptr_t *)calloc(t->cap, sizeof(uintptr_t));
+    t->locations = (Location *)malloc(t->cap * sizeof(Location));
+    t->calls = (CallCache *)malloc(t->cap * sizeof(CallCache));
+    t->used = 0;
+    for (size_t i = 0; i < old.cap; ++i)
+      if (old.keys[i] > LL_LOCATION_GONE)
+        ll_location_set((Object *)~old.keys[i], old.locations[i]);
+    free(old.keys);
+    free(old.locations);
+    free(old.calls);
+  }
+  uintptr_t key = ~(uintptr_t)o;
+  size_t i = ll_location_slot(key, t->cap);
+  while (t->keys[i])
+    i = (i + 1) & (t->cap - 1);
+  t->keys[i] = key;
+  t->locations[i] = l;
+  t->calls[i] = (CallCache){NULL, NULL, 0};
+  t->used++;
+}
+
+/* Returns the call cache entry of a located list or NULL. */
+static CallCache *ll_call_cache(Object *o) {
+  uintptr_t key = ~(uintptr_t)o;
+  if (!ll_locations.cap)
+    return NULL;
+  for (size_t i = ll_location_slot(key, ll_locations.cap); ll_locations.keys[i]; i = (i + 1) & (ll_locations.cap - 1))
+    if (ll_locations.keys[i] == key)
+      return &ll_locations.calls[i];
+  return NULL;
+}
+
+/* Looks up where `o` was read, only the first cons of lists created by `ll_read` has a location. */
+bool ll_location(Object *o, Location *l) {
+  uintptr_t key = ~(uintptr_t)o;
+  if (!ll_locations.cap || ll_immediate(o))
+    return false;
+  for (size_t i = ll_location_slot(key, ll_locations.cap); ll_locations.keys[i]; i = (i + 1) & (ll_locations.cap - 1))
+    if (ll_locations.keys[i] == key) {
+      *l = ll_locations.locations[i];
+      return true;
+    }
+  return false;
+}
+
+/* Line bookkeeping of a read, newlines are counted lazily up to the start of the next located form. */
+typedef struct LLReader {
+  const char *line_start, *counted;
+  unsigned line;
+} LLReader;
+
+static Location ll_reader_location(LLReader *r, const char *s) {
+  const char *nl;
+  while ((nl = memchr(r->counted, '\n', (size_t)(s - r->counted)))) {
+    r->line++;
+    r->counted = r->line_start = nl + 1;
+  }
+  r->counted = s;
+  size_t column = (size_t)(s - r->line_start) + 1;
+  unsigned short line = r->line < 0xFFFF ? (unsigned short)r->line : 0xFFFF;
+  return l_create(line, column < 0xFFFF ? (unsigned short)column : 0xFFFF);
+}
+
+static Object *ll_read_(Context *c, const char *t, const char **end, LLReader *r) {
+  Object *o = NULL;
+
+  t = ll_skip_space(t);
 
   const char *s = t;
-  if (*t == ')') {
+  if (*t == ')' || *t == ']') {
     ++t;
 
   } else if (*t == '(') {
     ++t;
 
-    Object *x[32];
-    int count = 0;
-    for (;;) {
-      assert(count < 32);
-      x[count] = ll_read(c, t, &t);
-      if (!x[count])
-        break;
-      ++count;
+    Location l = ll_reader_location(r, s);
+    Object *x, *tail = NULL;
+    while ((x = ll_read_(c, t, &t, r))) {
+      if (tail) {
+        tail = tail->cdr.ob = ll_cons(c, x, NULL);
+      } else {
+        o = tail = ll_malloc_ext(c, D_List, ll_location_forget);
+        o->car.ob = x;
+        o->cdr.ob = NULL;
+        ll_location_set(o, l);
+      }
     }
-    o = ll_list(c, count, x);
 
-  } else if (*t == '"') {
+  } else if (*t == '[') {
     ++t;
-    while (*t != '"' || *(t - 1) == '\\')
+
+    Object *items[16], **x = items, *e; // short vectors are collected on the stack
+    size_t n = 0, cap = sizeof(items) / sizeof(*items);
+    while ((e = ll_read_(c, t, &t, r))) {
+      if (n == cap) {
+        cap *= 2;
+        Object **grown = (Object **)ll_checked(gc_realloc(ll_heap, x == items ? NULL : x, cap * sizeof(Object *)));
+        if (x == items)
+          memcpy(grown, items, sizeof(items));
+        x = grown;
+      }
+      x[n++] = e;
+    }
+    o = ll_vector(c, n);
+    memcpy(ll_to_vector(o)->items, x, n * sizeof(Object *));
+    if (x != items)
+      gc_free(ll_heap, x);
+
+  } else if (*t == '"') {
+    bool escaped = false;
+    t = ll_scan_string(t + 1, &escaped);
+    o = escaped ? ll_string_unescape(c, s + 1, t) : ll_string_view(c, s + 1, t);
+    if (*t)
       ++t;
-    ++t;
-    o = ll_string_view(c, s + 1, t - 1);
 
   } else {
-    while (*t && !isspace(*t) && *t != ')' && *t != '(')
-      ++t;
+    t = ll_scan_atom(t);
 
+    long long i;
+    double d;
     if (t - s == 4 && strncmp(s, "true", 4) == 0)
       o = ll_bool(c, true);
     else if (t - s == 5 && strncmp(s, "false", 5) == 0)
       o = ll_bool(c, false);
     else if (t > s) {
-      char *end = NULL;
-      long long i = strtol(s, &end, 10);
-      if (end == t)
+      switch (ll_parse_number(s, t, &i, &d)) {
+      case D_Int:
         o = ll_int(c, i);
-      else {
-        double d = strtod(s, &end);
-        if (end == t)
-          o = ll_float(c, d);
-        else
-          o = ll_symbol_view(c, s, t);
+        break;
+      case D_Float:
+        o = ll_float(c, d);
+        break;
+      default:
+        o = ll_symbol_view(c, s, t);
       }
     }
   }
@@ -403,6 +1011,11 @@ Object *ll_read(Context *c, const char *t, const char **end) {
   return o;
 }
 
+Object *ll_read(Context *c, const char *t, const char **end) {
+  LLReader r = {t, t, 1};
+  return ll_read_(c, t, end, &r);
+}
+
 void test_parsing_atoms() {
   printf("%s...", __FUNCTION__);
 
@@ -420,7 +1033,9 @@ void test_parsing_atoms() {
   o = ll_read(&c, "\"a str\"", NULL);
   assert(o && ll_type(o) == D_String && strcmp(ll_to_string(o), "a str") == 0);
   o = ll_read(&c, "\"a long string with escaped \\\" str\"", NULL);
-  assert(o && ll_type(o) == D_String && strcmp(ll_to_string(o), "a long string with escaped \\\" str") == 0);
+  assert(o && ll_type(o) == D_String && strcmp(ll_to_string(o), "a long string with escaped \" str") == 0);
+  o = ll_read(&c, "\"tab\\t\\n\\q\"", NULL);
+  assert(o && ll_type_internal(o) == D_String && strcmp(ll_to_string(o), "tab\t\nq") == 0);
 
   o = ll_read(&c, "true", NULL);
   assert(o && ll_type(o) == D_Bool && ll_to_bool(o));
@@ -436,6 +1051,27 @@ void test_parsing_atoms() {
   assert(o && ll_type(o) == D_Float && ll_to_float(o) == 4.25);
   o = ll_read(&c, "\r -6.75e2 ", NULL);
   assert(o && ll_type(o) == D_Float && ll_to_float(o) == -6.75e2);
+  o = ll_read(&c, ".5", NULL);
+  assert(o && ll_type(o) == D_Float && ll_to_float(o) == 0.5);
+  o = ll_read(&c, "1.7976931348623157e308", NULL);
+  assert(o && ll_type(o) == D_Float && ll_to_float(o) == 1.7976931348623157e308);
+  o = ll_read(&c, "-9223372036854775808", NULL);
+  assert(o && ll_type(o) == D_Int && ll_to_int(o) == LLONG_MIN);
+  o = ll_read(&c, "1e", NULL);
+  assert(o && ll_type(o) == D_Symbol && strcmp(ll_to_symbol(o), "1e") == 0);
+  o = ll_read(&c, "-", NULL);
+  assert(o && ll_type(o) == D_Symbol && strcmp(ll_to_symbol(o), "-") == 0);
+
+  const char *end = NULL;
+  o = ll_read(&c, "\"esc\\\\\" x", &end);
+  assert(o && ll_type(o) == D_String && strcmp(ll_to_string(o), "esc\\") == 0);
+  assert(end && *end == ' ');
+  o = ll_read(&c, "\"unterminated", &end);
+  assert(o && ll_type(o) == D_String && strcmp(ll_to_string(o), "unterminated") == 0);
+  assert(end && *end == '\0');
+  o = ll_read(&c, "                                                 a_symbol_spanning_more_than_one_block(", &end);
+  assert(o && strcmp(ll_to_symbol(o), "a_symbol_spanning_more_than_one_block") == 0);
+  assert(end && *end == '(');
 
   printf("%s\n", "ok");
 }
@@ -477,104 +1113,4160 @@ void test_parsing_lists() {
   assert(ll_to_int(ll_car(ll_cdr(o))) == 3);
   assert(end && *end == '\0');
 
+  o = ll_read(&c, "[]", &end);
+  assert(o && ll_type(o) == D_Vector && ll_to_vector(o)->size == 0);
+  o = ll_read(&c, "[1 a[2 3](x)]", &end);
+  Vector *v = ll_to_vector(o);
+  assert(v->size == 4 && ll_to_int(v->items[0]) == 1 && strcmp(ll_to_symbol(v->items[1]), "a") == 0);
+  assert(ll_type(v->items[2]) == D_Vector && ll_to_int(ll_to_vector(v->items[2])->items[1]) == 3);
+  assert(ll_type(v->items[3]) == D_List);
+  assert(end && *end == '\0');
+
+  char many[512] = "(";
+  for (int i = 0; i < 100; ++i)
+    sprintf(many + strlen(many), " %d", i);
+  o = ll_read(&c, strcat(many, ")"), &end);
+  for (int i = 0; i < 100; ++i)
+    assert(ll_to_int(ll_next(&o)) == i);
+  assert(!o && end && *end == '\0');
+  many[0] = '[';
+  many[strlen(many) - 1] = ']';
+  v = ll_to_vector(ll_read(&c, many, &end));
+  assert(v->size == 100 && ll_to_int(v->items[15]) == 15 && ll_to_int(v->items[16]) == 16);
+  assert(ll_to_int(v->items[99]) == 99);
+
   printf("%s\n", "ok");
 }
 
-Object *ll_eval_add(Context *c, Object *a) {
-  assert(a);
-  Object *x = ll_next(&a);
-  assert(x && ll_type(x) == D_Int);
-  Object *y = ll_next(&a);
-  assert(y && ll_type(y) == D_Int);
-  return ll_int(c, ll_to_int(x) + ll_to_int(y));
+/*
+ * Binary images. `ll_image_dump` serializes the graph reachable from an object into a compact byte image and
+ * `ll_image_load` turns an image back into objects without going through the reader. Shared structure and cycles are
+ * preserved and symbols are interned in a table in front of the records. Loading takes two passes over the records,
+ * the first creates all objects so that records can refer forward and the second links them. Booleans and fixnums
+ * load as immediates, every other object is an allocation of its own and is collected like any other: the collector
+ * only knows pointers to the start of an allocation, so objects cannot share one block. Both directions fail with
+ * NULL when memory runs out.
+ *
+ * Layout (host byte order): magic, root ref, object count and symbol count as u32, then the symbol table (u32 length
+ * and bytes per symbol) and one DataType tagged record per object. A ref is 0 for nil, (symbol << 1) | 1 for an
+ * interned symbol and (object + 1) << 1 for any other object. Short strings are stored inline in 7 bytes, exactly
+ * like `Data.t`. CData and CFunc objects have no portable representation and make `ll_image_dump` fail.
+ */
+#define LL_IMAGE_MAGIC 0x49474c4cu /* "LLGI" */
+
+typedef struct LLBuf {
+  unsigned char *b;
+  size_t n, cap;
+  bool failed; // a reallocation failed, later writes are dropped
+} LLBuf;
+
+static void ll_buf_put(LLBuf *w, const void *p, size_t n) {
+  if (w->failed)
+    return;
+  if (w->n + n > w->cap) {
+    size_t cap = (w->n + n) * 2;
+    unsigned char *b = (unsigned char *)realloc(w->b, cap);
+    if (!b) {
+      w->failed = true;
+      return;
+    }
+    w->b = b;
+    w->cap = cap;
+  }
+  if (n)
+    memcpy(w->b + w->n, p, n);
+  w->n += n;
 }
+static void ll_buf_u32(LLBuf *w, uint32_t v) { ll_buf_put(w, &v, sizeof(v)); }
 
-void ll_init_context(Context *c) {
+typedef struct LLImageWriter {
+  Object **objs; // objects in record order, doubles as work queue
+  size_t nobjs, cap;
+  Object **keys; // open addressing map object -> ref
+  uint32_t *refs;
+  size_t nkeys, keys_cap;
+  const char **syms; // interned symbol texts
+  size_t nsyms;
+  uint32_t *sym_slots; // open addressing map text -> symbol index + 1
+  size_t sym_cap;
+  LLBuf symtab;
+  bool failed; // out of memory, refs handed out afterwards are 0
+} LLImageWriter;
+
+static size_t ll_image_align(size_t n) { return (n + 7) & ~(size_t)7; }
 
-  Object *globals[] = {
-      ll_cons(c, ll_symbol(c, "+"), ll_cfunc(c, ll_eval_add)),
-  };
+static size_t ll_ptr_hash(const void *p) { return (size_t)(((uintptr_t)p >> 3) * 0x9E3779B97F4A7C15ull); }
 
-  c->defined_symbols = ll_list(c, sizeof(globals) / sizeof(Object *), globals);
+static bool ll_image_grow(LLImageWriter *w) {
+  size_t cap = w->keys_cap ? w->keys_cap * 2 : 64;
+  Object **keys = (Object **)calloc(cap, sizeof(Object *));
+  uint32_t *refs = (uint32_t *)malloc(cap * sizeof(uint32_t));
+  if (!keys || !refs) {
+    free(keys);
+    free(refs);
+    return false;
+  }
+  for (size_t i = 0; i < w->keys_cap; ++i) {
+    if (!w->keys[i])
+      continue;
+    size_t j = ll_ptr_hash(w->keys[i]) & (cap - 1);
+    while (keys[j])
+      j = (j + 1) & (cap - 1);
+    keys[j] = w->keys[i];
+    refs[j] = w->refs[i];
+  }
+  free(w->keys);
+  free(w->refs);
+  w->keys = keys;
+  w->refs = refs;
+  w->keys_cap = cap;
+  return true;
 }
 
-void ll_free_context(Context *c) { c->defined_symbols = NULL; }
+static size_t ll_text_hash(const char *s) {
+  size_t h = 14695981039346656037ull;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 1099511628211ull;
+  return h;
+}
 
-Object *ll_defined_symbol(Context *c, const char *sym) {
-  Object *p = NULL;
-  Object *x = c->defined_symbols;
-  while ((p = ll_next(&x))) {
-    if (strcmp(ll_to_symbol(ll_car(p)), sym) == 0)
-      return ll_cdr(p);
-    break;
+static uint32_t ll_image_symbol(LLImageWriter *w, const char *s) {
+  if (2 * (w->nsyms + 1) > w->sym_cap) {
+    size_t cap = w->sym_cap ? w->sym_cap * 2 : 64;
+    uint32_t *slots = (uint32_t *)calloc(cap, sizeof(uint32_t));
+    const char **syms = (const char **)realloc(w->syms, cap / 2 * sizeof(const char *));
+    if (syms)
+      w->syms = syms;
+    if (!slots || !syms) {
+      free(slots);
+      w->failed = true;
+      return 0;
+    }
+    free(w->sym_slots);
+    w->sym_slots = slots;
+    w->sym_cap = cap;
+    for (size_t i = 0; i < w->nsyms; ++i) {
+      size_t j = ll_text_hash(w->syms[i]) & (w->sym_cap - 1);
+      while (w->sym_slots[j])
+        j = (j + 1) & (w->sym_cap - 1);
+      w->sym_slots[j] = (uint32_t)i + 1;
+    }
   }
-  return NULL;
+  size_t j = ll_text_hash(s) & (w->sym_cap - 1);
+  for (; w->sym_slots[j]; j = (j + 1) & (w->sym_cap - 1))
+    if (strcmp(w->syms[w->sym_slots[j] - 1], s) == 0)
+      return ((w->sym_slots[j] - 1) << 1) | 1;
+
+  uint32_t l = (uint32_t)strlen(s);
+  ll_buf_u32(&w->symtab, l);
+  ll_buf_put(&w->symtab, s, l);
+  w->syms[w->nsyms] = s;
+  w->sym_slots[j] = (uint32_t)++w->nsyms;
+  return (uint32_t)((w->nsyms - 1) << 1) | 1;
 }
 
-Object *ll_eval(Context *c, Object *o) {
-  if (ll_type(o) != D_List)
-    return o;
+static uint32_t ll_image_ref(LLImageWriter *w, Object *o) {
+  if (!o || w->failed)
+    return 0;
+  if (2 * (w->nkeys + 1) > w->keys_cap && !ll_image_grow(w)) {
+    w->failed = true;
+    return 0;
+  }
+  size_t j = ll_ptr_hash(o) & (w->keys_cap - 1);
+  for (; w->keys[j]; j = (j + 1) & (w->keys_cap - 1))
+    if (w->keys[j] == o)
+      return w->refs[j];
+  uint32_t ref;
+  if (ll_type(o) == D_Symbol) {
+    if (!(ref = ll_image_symbol(w, ll_to_symbol(o))))
+      return 0;
+  } else {
+    if (w->nobjs == w->cap) {
+      size_t cap = w->cap ? w->cap * 2 : 64;
+      Object **objs = (Object **)realloc(w->objs, cap * sizeof(Object *));
+      if (!objs) {
+        w->failed = true;
+        return 0;
+      }
+      w->objs = objs;
+      w->cap = cap;
+    }
+    w->objs[w->nobjs] = o;
+    ref = (uint32_t)(++w->nobjs) << 1;
+  }
+  w->keys[j] = o;
+  w->refs[j] = ref;
+  w->nkeys++;
+  return ref;
+}
 
-  Object *fn = ll_car(o);
-  assert(fn && ll_type(fn) == D_Symbol);
+static void ll_image_writer_free(LLImageWriter *w) {
+  free(w->symtab.b);
+  free(w->syms);
+  free(w->sym_slots);
+  free(w->objs);
+  free(w->keys);
+  free(w->refs);
+}
 
-  fn = ll_defined_symbol(c, ll_to_symbol(fn));
-  assert(fn && ll_type(fn) == D_CFunc);
+void *ll_image_dump(Context *c, Object *o, size_t *size) {
+  (void)c;
+  LLImageWriter w = {0};
+  LLBuf records = {0};
+  uint32_t root = ll_image_ref(&w, o);
+  bool ok = true;
+  for (size_t i = 0; ok && i < w.nobjs; ++i) {
+    Object *x = w.objs[i];
+    unsigned char dt = (unsigned char)ll_type_internal(x);
+    ll_buf_put(&records, &dt, 1);
+    switch (ll_type_internal(x)) {
+    case D_List:
+      ll_buf_u32(&records, ll_image_ref(&w, x->car.ob));
+      ll_buf_u32(&records, ll_image_ref(&w, x->cdr.ob));
+      break;
+    case D_String:
+      ll_buf_put(&records, x->cdr.t, 7);
+      break;
+    case D_LongString: {
+      uint32_t l = (uint32_t)strlen(x->cdr.lt);
+      ll_buf_u32(&records, l);
+      ll_buf_put(&records, x->cdr.lt, l);
+      break;
+    }
+    case D_Vector: {
+      Vector *v = ll_to_vector(x);
+      ll_buf_u32(&records, (uint32_t)v->size);
+      for (size_t j = 0; j < v->size; ++j)
+        ll_buf_u32(&records, ll_image_ref(&w, v->items[j]));
+      break;
+    }
+    case D_I64Array:
+    case D_F64Array: {
+      Array *a = ll_to_array(x);
+      ll_buf_u32(&records, (uint32_t)a->size);
+      ll_buf_put(&records, a + 1, a->size * sizeof(double));
+      break;
+    }
+    case D_Bool: {
+      bool b = ll_to_bool(x);
+      ll_buf_put(&records, &b, 1);
+      break;
+    }
+    case D_Int: {
+      long long v = ll_to_int(x);
+      ll_buf_put(&records, &v, sizeof(v));
+      break;
+    }
+    case D_Float:
+      ll_buf_put(&records, &x->cdr.f, sizeof(x->cdr.f));
+      break;
+    default:
+      ok = false;
+    }
+  }
 
-  Object *args = ll_cdr(o);
-  return ll_to_cfunc(fn)(c, args);
+  LLBuf image = {0};
+  if (ok && !w.failed && !w.symtab.failed && !records.failed) {
+    ll_buf_u32(&image, LL_IMAGE_MAGIC);
+    ll_buf_u32(&image, root);
+    ll_buf_u32(&image, (uint32_t)w.nobjs);
+    ll_buf_u32(&image, (uint32_t)w.nsyms);
+    ll_buf_put(&image, w.symtab.b, w.symtab.n);
+    ll_buf_put(&image, records.b, records.n);
+    *size = image.n;
+  }
+  if (image.failed) {
+    free(image.b);
+    image.b = NULL;
+  }
+  free(records.b);
+  ll_image_writer_free(&w);
+  return image.b;
 }
 
-void test_context_initialization() {
+typedef struct LLImageReader {
+  const unsigned char *p, *e;
+} LLImageReader;
+
+static bool ll_image_get(LLImageReader *r, void *v, size_t n) {
+  if ((size_t)(r->e - r->p) < n)
+    return false;
+  memcpy(v, r->p, n);
+  r->p += n;
+  return true;
+}
+
+/* Places a text of an image either inline or in an allocation of its own. */
+static bool ll_image_text(Object *o, const void *b, size_t l) {
+  char *t = o->cdr.t;
+  if (l > 7 && !(t = o->cdr.lt = (char *)gc_malloc_atomic(ll_heap, l + 1)))
+    return false;
+  memcpy(t, b, l);
+  t[l] = '\0';
+  return true;
+}
+
+static bool ll_image_deref(Object **objs, uint32_t nobjs, uint32_t nsyms, uint32_t ref, Object **o) {
+  if (!ref)
+    *o = NULL;
+  else if (ref & 1 && (ref >> 1) < nsyms)
+    *o = objs[nobjs + (ref >> 1)];
+  else if (!(ref & 1) && (ref >> 1) - 1 < nobjs)
+    *o = objs[(ref >> 1) - 1];
+  else
+    return false;
+  return true;
+}
+
+static bool ll_image_skip(LLImageReader *r, size_t n) {
+  if ((size_t)(r->e - r->p) < n)
+    return false;
+  r->p += n;
+  return true;
+}
+
+/* Allocates an object for a record, with a body of `extra` bytes that is scanned unless it is `atomic`. */
+static Object *ll_image_object(DataType dt, size_t extra, bool atomic) {
+  Object *o = (Object *)gc_calloc(ll_heap, 1, sizeof(Object));
+  if (!o)
+    return NULL;
+  o->car.dt = dt;
+  if (extra && !(o->cdr.cd = atomic ? gc_malloc_atomic(ll_heap, extra) : gc_calloc(ll_heap, 1, extra)))
+    return NULL;
+  return o;
+}
+
+/*
+ * Reads the record of object `i`. The first pass (`link` false) creates the object with its contents, the second
+ * fills in the references of lists and vectors once all objects exist and skips every other record.
+ */
+static bool ll_image_record(Context *c, LLImageReader *r, Object **objs, uint32_t i, uint32_t nobjs, uint32_t nsyms,
+                            bool link) {
+  Object **o = &objs[i];
+  unsigned char dt;
+  uint32_t car, cdr, l;
+  if (!ll_image_get(r, &dt, 1))
+    return false;
+  switch (dt) {
+  case D_List:
+    if (!link)
+      return ll_image_skip(r, 8) && (*o = ll_image_object(D_List, 0, false));
+    return ll_image_get(r, &car, 4) && ll_image_get(r, &cdr, 4) &&
+           ll_image_deref(objs, nobjs, nsyms, car, &(*o)->car.ob) &&
+           ll_image_deref(objs, nobjs, nsyms, cdr, &(*o)->cdr.ob);
+  case D_String:
+    if (link)
+      return ll_image_skip(r, 7);
+    return (*o = ll_image_object(D_String, 0, false)) && ll_image_get(r, (*o)->cdr.t, 7);
+  case D_LongString:
+    if (!ll_image_get(r, &l, 4) || l > (size_t)(r->e - r->p))
+      return false;
+    if (!link && !((*o = ll_image_object(D_LongString, 0, false)) && ll_image_text(*o, r->p, l)))
+      return false;
+    return ll_image_skip(r, l);
+  case D_Vector:
+    if (!ll_image_get(r, &l, 4) || l > (size_t)(r->e - r->p) / 4)
+      return false;
+    if (!link) {
+      if (!(*o = ll_image_object(D_Vector, sizeof(Vector) + l * sizeof(Object *), false)))
+        return false;
+      ll_to_vector(*o)->size = l;
+      return ll_image_skip(r, l * 4);
+    }
+    for (uint32_t j = 0; j < l; ++j)
+      if (!ll_image_get(r, &car, 4) || !ll_image_deref(objs, nobjs, nsyms, car, &ll_to_vector(*o)->items[j]))
+        return false;
+    return true;
+  case D_I64Array:
+  case D_F64Array:
+    if (!ll_image_get(r, &l, 4) || l > (size_t)(r->e - r->p) / sizeof(double))
+      return false;
+    if (link)
+      return ll_image_skip(r, l * sizeof(double));
+    if (!(*o = ll_image_object((DataType)dt, sizeof(Array) + l * sizeof(double), true)))
+      return false;
+    ll_to_array(*o)->size = l;
+    return ll_image_get(r, ll_to_array(*o) + 1, l * sizeof(double));
+  case D_Bool: {
+    unsigned char b;
+    if (!ll_image_get(r, &b, 1))
+      return false;
+    if (!link)
+      *o = ll_bool(c, b != 0);
+    return true;
+  }
+  case D_Int: {
+    long long v;
+    if (!ll_image_get(r, &v, sizeof(v)))
+      return false;
+    if (link || (v >= LL_FIXNUM_MIN && v <= LL_FIXNUM_MAX && (*o = ll_int(c, v))))
+      return true;
+    if (!(*o = ll_image_object(D_Int, 0, false)))
+      return false;
+    (*o)->cdr.i = v;
+    return true;
+  }
+  case D_Float: {
+    double f;
+    if (!ll_image_get(r, &f, sizeof(f)))
+      return false;
+    if (link)
+      return true;
+    if (!(*o = ll_image_object(D_Float, 0, false)))
+      return false;
+    (*o)->cdr.f = f;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+Object *ll_image_load(Context *c, const void *image, size_t size) {
+  LLImageReader r = {(const unsigned char *)image, (const unsigned char *)image + size};
+  uint32_t magic, root, nobjs, nsyms;
+  if (!ll_image_get(&r, &magic, 4) || magic != LL_IMAGE_MAGIC || !ll_image_get(&r, &root, 4) ||
+      !ll_image_get(&r, &nobjs, 4) || !ll_image_get(&r, &nsyms, 4) || (size_t)nobjs + nsyms > size || !root)
+    return NULL;
+
+  // the index keeps the objects reachable until the root refers to them, collecting before that frees none of them
+  bool paused = ll_heap->paused;
+  gc_pause(ll_heap);
+  Object **objs = (Object **)gc_calloc(ll_heap, (size_t)nobjs + nsyms, sizeof(Object *));
+  bool ok = objs != NULL;
+  for (uint32_t i = 0; ok && i < nsyms; ++i) {
+    uint32_t l;
+    ok = ll_image_get(&r, &l, 4) && l <= (size_t)(r.e - r.p) &&
+         (objs[nobjs + i] = ll_image_object(l > 7 ? D_LongSymbol : D_Symbol, 0, false)) &&
+         ll_image_text(objs[nobjs + i], r.p, l);
+    if (ok)
+      r.p += l;
+  }
+  const unsigned char *records = r.p;
+  for (uint32_t i = 0; ok && i < nobjs; ++i)
+    ok = ll_image_record(c, &r, objs, i, nobjs, nsyms, false);
+  r.p = records;
+  for (uint32_t i = 0; ok && i < nobjs; ++i)
+    ok = ll_image_record(c, &r, objs, i, nobjs, nsyms, true);
+
+  Object *o = NULL;
+  if (ok)
+    ok = ll_image_deref(objs, nobjs, nsyms, root, &o);
+  if (objs)
+    gc_free(ll_heap, objs); // on failure the objects loaded so far are garbage
+  if (!paused)
+    gc_resume(ll_heap);
+  return ok ? o : NULL;
+}
+
+void test_parsing_locations() {
   printf("%s...", __FUNCTION__);
 
   Context c;
-  ll_init_context(&c);
-  assert(c.defined_symbols);
-
-  Object *add = ll_defined_symbol(&c, "+");
-  assert(add && ll_type(add) == D_CFunc);
+  Location l;
+  Object *o = ll_read(&c, "(a\n  (b c)\n (\"multi\nline\" (d)))", NULL);
+  assert(ll_location(o, &l) && l_line(l) == 1 && l_column(l) == 1);
+  assert(!ll_location(ll_car(o), &l));
+  Object *x = ll_car(ll_cdr(o));
+  assert(ll_location(x, &l) && l_line(l) == 2 && l_column(l) == 3);
+  x = ll_car(ll_cdr(ll_cdr(o)));
+  assert(ll_location(x, &l) && l_line(l) == 3 && l_column(l) == 2);
+  x = ll_car(ll_cdr(x));
+  assert(ll_location(x, &l) && l_line(l) == 4 && l_column(l) == 7);
 
-  ll_free_context(&c);
-  assert(!c.defined_symbols);
+  assert(!ll_location(ll_cons(&c, NULL, NULL), &l));
+  assert(!ll_location(ll_int(&c, 1), &l));
 
   printf("%s\n", "ok");
 }
 
-void test_context_evaluation() {
+void test_image_roundtrip() {
   printf("%s...", __FUNCTION__);
 
   Context c;
-  ll_init_context(&c);
+  Object *shared = ll_read(&c, "(\"a long shared string\" 4.5)", NULL);
+  Object *o = ll_list(&c, 8,
+                      (Object *[]){ll_symbol(&c, "sym"), ll_symbol(&c, "a_quite_long_sym"), ll_symbol(&c, "sym"),
+                                   ll_int(&c, -42), ll_bool(&c, true), shared, shared,
+                                   ll_read(&c, "[\"a long vector string\" [] sym]", NULL)});
+  Object *cycle = ll_cons(&c, ll_string(&c, "short"), NULL);
+  cycle->cdr.ob = cycle;
+  o = ll_cons(&c, cycle, o);
 
-  Object *code = ll_read(&c, "(+ 1 3)", NULL);
-  assert(code);
+  size_t size = 0;
+  void *image = ll_image_dump(&c, o, &size);
+  assert(image && size > 0);
+  Object *l = ll_image_load(&c, image, size);
+  assert(l && l != o && ll_type(l) == D_List && gc_owns(ll_heap, l)); // collected like any other list
 
-  Object *r = ll_eval(&c, code);
-  assert(ll_to_int(r) == 4);
+  Object *lc = ll_next(&l);
+  assert(strcmp(ll_to_string(ll_car(lc)), "short") == 0 && ll_cdr(lc) == lc);
+  Object *s1 = ll_next(&l);
+  assert(strcmp(ll_to_symbol(s1), "sym") == 0);
+  assert(strcmp(ll_to_symbol(ll_next(&l)), "a_quite_long_sym") == 0);
+  assert(ll_next(&l) == s1);
+  assert(ll_to_int(ll_next(&l)) == -42);
+  assert(ll_to_bool(ll_next(&l)));
+  Object *ls = ll_next(&l);
+  assert(strcmp(ll_to_string(ll_car(ls)), "a long shared string") == 0);
+  assert(ll_to_float(ll_car(ll_cdr(ls))) == 4.5);
+  assert(ll_next(&l) == ls);
+  Vector *v = ll_to_vector(ll_next(&l));
+  assert(v->size == 3 && strcmp(ll_to_string(v->items[0]), "a long vector string") == 0);
+  assert(ll_to_vector(v->items[1])->size == 0 && v->items[2] == s1 && !l);
 
-  ll_free_context(&c);
-  assert(!c.defined_symbols);
+  // booleans and fixnums load as the immediates the interpreter compares by identity
+  size_t values_size = 0;
+  void *values = ll_image_dump(&c, ll_read(&c, "(false 7 4611686018427387904)", NULL), &values_size);
+  l = ll_image_load(&c, values, values_size);
+  free(values);
+  assert(ll_car(l) == ll_bool(&c, false) && ll_car(ll_cdr(l)) == ll_int(&c, 7));
+  assert(ll_to_int(ll_car(ll_cdr(ll_cdr(l)))) == 4611686018427387904ll);
+
+  assert(!ll_image_load(&c, image, size - 1));
+  gc_heap_limit(ll_heap, 1); // every allocation fails
+  assert(!ll_image_load(&c, image, size));
+  gc_heap_limit(ll_heap, 0);
+  free(image);
+
+  assert(!ll_image_dump(&c, ll_cfunc(&c, dummy_cfunc), &size));
 
   printf("%s\n", "ok");
 }
 
-int main(int argc, char *argv[]) {
-  printf("(hi %s)\n", "llgc");
+/* Text of a string, symbol or builder, the length is returned in `l`. */
+static const char *ll_text_of(Object *o, size_t *l) {
+  if (ll_type(o) == D_Builder) {
+    *l = ll_to_builder(o)->size;
+    return *l ? ll_to_builder(o)->text : "";
+  }
+  const char *t = ll_type(o) == D_Symbol ? ll_to_symbol(o) : ll_to_string(o);
+  *l = strlen(t);
+  return t;
+}
 
-  gc_start(&gc, &argc);
+/* (builder x...) creates a builder holding the concatenation of its arguments. */
+Object *ll_eval_builder(Context *c, Object *a) {
+  Object *b = ll_builder(c);
+  while (a) {
+    size_t l;
+    const char *t = ll_text_of(ll_next(&a), &l);
+    ll_builder_append(b, t, l);
+  }
+  return b;
+}
 
-  test_Location();
-  test_DataType();
-  test_object_atoms();
-  test_object_list_creation();
-  test_object_list_interaction();
+/* (append b x...) appends to builder b in place and returns it. */
+Object *ll_eval_append(Context *c, Object *a) {
+  Object *b = ll_next(&a);
+  assert(ll_type(b) == D_Builder);
+  while (a) {
+    size_t l;
+    const char *t = ll_text_of(ll_next(&a), &l);
+    ll_builder_append(b, t, l);
+  }
+  return b;
+}
+
+/* (str x) flattens a builder, strings are returned as they are. */
+Object *ll_eval_str(Context *c, Object *a) {
+  Object *x = ll_next(&a);
+  return ll_type(x) == D_Builder ? ll_builder_string(c, x) : x;
+}
+
+/* (substring s start end), `end` defaults to the length of s. */
+Object *ll_eval_substring(Context *c, Object *a) {
+  size_t l;
+  const char *t = ll_text_of(ll_next(&a), &l);
+  long long b = ll_to_int(ll_next(&a)), e = a ? ll_to_int(ll_next(&a)) : (long long)l;
+  assert(0 <= b && b <= e && (size_t)e <= l);
+  return ll_string_view(c, t + b, t + e);
+}
+
+/* (join sep seq) concatenates the strings of a list or vector, the texts are copied straight into the result. */
+Object *ll_eval_join(Context *c, Object *a) {
+  size_t ls, n = 0, total = 0;
+  const char *sep = ll_text_of(ll_next(&a), &ls);
+  Object *s = ll_next(&a);
+  bool vec = ll_type(s) == D_Vector;
+  for (Object *x = s; vec ? n < ll_to_vector(s)->size : x != NULL; ++n) {
+    size_t l;
+    ll_text_of(vec ? ll_to_vector(s)->items[n] : ll_next(&x), &l);
+    total += l + (n ? ls : 0);
+  }
+  Object *r = ll_malloc(c, total > 7 ? D_LongString : D_String);
+  char *d = ll_text_room_(r, total);
+  for (size_t i = 0; i < n; ++i) {
+    size_t l;
+    const char *t = ll_text_of(vec ? ll_to_vector(s)->items[i] : ll_next(&s), &l);
+    if (i) {
+      memcpy(d, sep, ls);
+      d += ls;
+    }
+    memcpy(d, t, l);
+    d += l;
+  }
+  return r;
+}
+
+/*
+ * Weak tables map keys to values by identity without keeping either alive: the entries are an ephemeron allocation,
+ * so a value is only retained while its key is reachable from outside the table, and the collector clears the pair
+ * once the key dies. Lookups probe linearly, cleared and deleted keys are GC_CLEARED tombstones that are skipped on
+ * lookup, reused on insert and dropped when the table grows. Symbols are not interned, so they only make useful keys
+ * when the same symbol object is passed around.
+ */
+typedef struct Table {
+  size_t used, cap; // `used` counts live entries and tombstones
+  Object **pairs;
+} Table;
+
+#define LL_TABLE_MIN 8
+
+Object *ll_table(Context *c) {
+  Object *o = ll_malloc(c, D_Table);
+  Table *t = (Table *)ll_checked(gc_calloc(ll_heap, 1, sizeof(Table)));
+  o->cdr.cd = t;
+  t->pairs = (Object **)ll_checked(gc_calloc_ephemeron(ll_heap, LL_TABLE_MIN));
+  t->cap = LL_TABLE_MIN;
+  return o;
+}
+
+Table *ll_to_table(Object *o) {
+  assert(ll_type(o) == D_Table);
+  return (Table *)o->cdr.cd;
+}
+
+static inline bool ll_table_live(Object *key) { return key && key != GC_CLEARED; }
+
+/* Finds the pair of `key`, or with `insert` the free slot it goes to. At least one slot is always empty. */
+static Object **ll_table_slot(Table *t, Object *key, bool insert) {
+  size_t mask = t->cap - 1;
+  Object **reuse = NULL;
+  for (size_t i = ll_ptr_hash(key) & mask;; i = (i + 1) & mask) {
+    Object **p = t->pairs + 2 * i;
+    if (p[0] == key)
+      return p;
+    if (!p[0])
+      return !insert ? NULL : reuse ? reuse : p;
+    if (p[0] == GC_CLEARED && !reuse)
+      reuse = p;
+  }
+}
+
+size_t ll_table_count(Object *o) {
+  Table *t = ll_to_table(o);
+  size_t n = 0;
+  for (size_t i = 0; i < t->cap; ++i)
+    n += ll_table_live(t->pairs[2 * i]);
+  return n;
+}
+
+/* Returns the value of `key`, or `missing` if there is none. */
+Object *ll_table_get(Object *o, Object *key, Object *missing) {
+  Object **p = key ? ll_table_slot(ll_to_table(o), key, false) : NULL;
+  return p ? p[1] : missing;
+}
+
+void ll_table_set(Object *o, Object *key, Object *value) {
+  assert(ll_table_live(key));
+  Table *t = ll_to_table(o);
+  if ((t->used + 1) * 4 > t->cap * 3) {
+    size_t live = ll_table_count(o), cap = LL_TABLE_MIN;
+    while (cap < 2 * (live + 1))
+      cap *= 2;
+    Object **pairs = (Object **)ll_checked(gc_calloc_ephemeron(ll_heap, cap)), **old = t->pairs;
+    size_t old_cap = t->cap;
+    t->pairs = pairs;
+    t->cap = cap;
+    t->used = 0;
+    for (size_t i = 0; i < old_cap; ++i) {
+      if (ll_table_live(old[2 * i])) {
+        Object **p = ll_table_slot(t, old[2 * i], true);
+        p[0] = old[2 * i];
+        p[1] = old[2 * i + 1];
+        ++t->used;
+      }
+    }
+  }
+  Object **p = ll_table_slot(t, key, true);
+  if (!p[0])
+    ++t->used;
+  p[0] = key;
+  p[1] = value;
+}
+
+void ll_table_delete(Object *o, Object *key) {
+  Object **p = key ? ll_table_slot(ll_to_table(o), key, false) : NULL;
+  if (p) {
+    p[0] = (Object *)GC_CLEARED;
+    p[1] = NULL;
+  }
+}
+
+/* A weak reference yields its target until the target is collected, and nil after that. */
+Object *ll_weak(Context *c, Object *target) {
+  Object *o = ll_malloc(c, D_Weak);
+  Object **slot = (Object **)ll_checked(gc_calloc_weak(ll_heap, 1));
+  *slot = target;
+  o->cdr.cd = slot;
+  return o;
+}
+
+Object *ll_weak_get(Object *o) {
+  assert(ll_type(o) == D_Weak);
+  return *(Object **)o->cdr.cd;
+}
+
+/* (table) creates an empty weak table. */
+Object *ll_eval_table(Context *c, Object *a) { return ll_table(c); }
+
+/* (table-get t key default), `default` is nil if omitted. */
+Object *ll_eval_table_get(Context *c, Object *a) {
+  Object *t = ll_next(&a), *key = ll_next(&a);
+  return ll_table_get(t, key, a ? ll_next(&a) : NULL);
+}
+
+/* (table-set t key value) returns value. */
+Object *ll_eval_table_set(Context *c, Object *a) {
+  Object *t = ll_next(&a), *key = ll_next(&a), *value = ll_next(&a);
+  ll_table_set(t, key, value);
+  return value;
+}
+
+Object *ll_eval_table_delete(Context *c, Object *a) {
+  Object *t = ll_next(&a);
+  ll_table_delete(t, ll_next(&a));
+  return t;
+}
+
+Object *ll_eval_table_count(Context *c, Object *a) { return ll_int(c, (long long)ll_table_count(ll_next(&a))); }
+
+Object *ll_eval_weak(Context *c, Object *a) { return ll_weak(c, ll_next(&a)); }
+
+Object *ll_eval_weak_get(Context *c, Object *a) { return ll_weak_get(ll_next(&a)); }
+
+/*
+ * Arithmetic. The numeric builtins take any number of arguments and fold them in one pass into a native accumulator,
+ * only the result is boxed. Integers are promoted to float when mixed with a float or when a result overflows.
+ */
+typedef enum NumOp { N_ADD, N_SUB, N_MUL, N_DIV } NumOp;
+
+typedef struct Number {
+  bool is_float;
+  long long i;
+  double f;
+} Number;
+
+static inline Number ll_number(Object *o) {
+  if (ll_type(o) == D_Int)
+    return (Number){false, ll_to_int(o), 0.0};
+  assert(ll_type(o) == D_Float);
+  return (Number){true, 0, ll_to_float(o)};
+}
+
+static inline double ll_number_float(Number n) { return n.is_float ? n.f : (double)n.i; }
+
+static Number ll_number_op(NumOp op, Number x, Number y) {
+  if (!x.is_float && !y.is_float) {
+    long long r;
+    switch (op) {
+    case N_ADD:
+      if (!__builtin_add_overflow(x.i, y.i, &r))
+        return (Number){false, r, 0.0};
+      break;
+    case N_SUB:
+      if (!__builtin_sub_overflow(x.i, y.i, &r))
+        return (Number){false, r, 0.0};
+      break;
+    case N_MUL:
+      if (!__builtin_mul_overflow(x.i, y.i, &r))
+        return (Number){false, r, 0.0};
+      break;
+    case N_DIV: // exact quotients stay integers, everything else (including division by zero) is done in float
+      if (y.i != 0 && !(x.i == LLONG_MIN && y.i == -1) && x.i % y.i == 0)
+        return (Number){false, x.i / y.i, 0.0};
+      break;
+    }
+  }
+  double a = ll_number_float(x), b = ll_number_float(y);
+  switch (op) {
+  case N_ADD:
+    return (Number){true, 0, a + b};
+  case N_SUB:
+    return (Number){true, 0, a - b};
+  case N_MUL:
+    return (Number){true, 0, a * b};
+  case N_DIV:
+    break;
+  }
+  return (Number){true, 0, a / b};
+}
+
+/* (+) is 0 and (*) is 1, a single argument is negated by `-` and inverted by `/`. */
+static Object *ll_arithmetic(Context *c, NumOp op, Object *a) {
+  Number acc = {false, op == N_MUL || op == N_DIV, 0.0};
+  if (a && ll_cdr(a) && (op == N_SUB || op == N_DIV))
+    acc = ll_number(ll_next(&a));
+  while (a)
+    acc = ll_number_op(op, acc, ll_number(ll_next(&a)));
+  return acc.is_float ? ll_float(c, acc.f) : ll_int(c, acc.i);
+}
+
+Object *ll_eval_add(Context *c, Object *a) { return ll_arithmetic(c, N_ADD, a); }
+Object *ll_eval_sub(Context *c, Object *a) { return ll_arithmetic(c, N_SUB, a); }
+Object *ll_eval_mul(Context *c, Object *a) { return ll_arithmetic(c, N_MUL, a); }
+Object *ll_eval_div(Context *c, Object *a) { return ll_arithmetic(c, N_DIV, a); }
+
+/* Returns -1, 0 or 1, or 2 for a NaN, which is unordered. Integers are compared exactly, mixed pairs as doubles. */
+static inline int ll_number_cmp(Number x, Number y) {
+  if (!x.is_float && !y.is_float)
+    return (x.i > y.i) - (x.i < y.i);
+  double a = ll_number_float(x), b = ll_number_float(y);
+  return a != a || b != b ? 2 : (a > b) - (a < b);
+}
+
+/*
+ * Comparisons are chained, (< a b c) holds if a < b and b < c. The mask selects the accepted results of cmp + 1, none
+ * accepts an unordered pair, so every comparison involving a NaN is false.
+ */
+static Object *ll_compare(Context *c, unsigned mask, Object *a) {
+  bool r = true;
+  if (a) {
+    Number x = ll_number(ll_next(&a));
+    while (a) {
+      Number y = ll_number(ll_next(&a));
+      r = r && (mask >> (ll_number_cmp(x, y) + 1) & 1);
+      x = y;
+    }
+  }
+  return ll_bool(c, r);
+}
+
+Object *ll_eval_lt(Context *c, Object *a) { return ll_compare(c, 1, a); }
+Object *ll_eval_eq(Context *c, Object *a) { return ll_compare(c, 2, a); }
+Object *ll_eval_gt(Context *c, Object *a) { return ll_compare(c, 4, a); }
+Object *ll_eval_le(Context *c, Object *a) { return ll_compare(c, 3, a); }
+Object *ll_eval_ge(Context *c, Object *a) { return ll_compare(c, 6, a); }
+
+/*
+ * The numeric builtins on a window of `n` argument registers of the VM instead of an argument list, see OP_CALL.
+ * Returns false if `fn` is no numeric builtin.
+ */
+static bool ll_call_window(Context *c, CFunc fn, Object *const *a, size_t n, Object **r) {
+  static const struct {
+    CFunc fn;
+    NumOp op;
+    unsigned mask; // comparisons only
+  } window[] = {{ll_eval_add, N_ADD, 0}, {ll_eval_sub, N_SUB, 0}, {ll_eval_mul, N_MUL, 0}, {ll_eval_div, N_DIV, 0},
+                {ll_eval_lt, N_ADD, 1},  {ll_eval_eq, N_ADD, 2},  {ll_eval_gt, N_ADD, 4},  {ll_eval_le, N_ADD, 3},
+                {ll_eval_ge, N_ADD, 6}};
+  size_t j = 0;
+  while (j < sizeof(window) / sizeof(*window) && window[j].fn != fn)
+    ++j;
+  if (j == sizeof(window) / sizeof(*window))
+    return false;
+  if (window[j].mask) {
+    bool holds = true;
+    for (size_t i = 1; holds && i < n; ++i)
+      holds = window[j].mask >> (ll_number_cmp(ll_number(a[i - 1]), ll_number(a[i])) + 1) & 1;
+    *r = ll_bool(c, holds);
+    return true;
+  }
+  NumOp op = window[j].op;
+  Number acc = {false, op == N_MUL || op == N_DIV, 0.0};
+  size_t i = 0;
+  if (n > 1 && (op == N_SUB || op == N_DIV))
+    acc = ll_number(a[i++]);
+  for (; i < n; ++i)
+    acc = ll_number_op(op, acc, ll_number(a[i]));
+  *r = acc.is_float ? ll_float(c, acc.f) : ll_int(c, acc.i);
+  return true;
+}
+
+Object *ll_defined_symbol(Context *c, const char *sym);
+Object *ll_apply(Context *c, Object *fn, Object *args);
+
+Object *ll_eval_vec(Context *c, Object *a) {
+  size_t n = 0;
+  for (Object *x = a; x; x = ll_cdr(x))
+    ++n;
+  Object *v = ll_vector(c, n);
+  for (Object **p = ll_to_vector(v)->items; a;)
+    *p++ = ll_next(&a);
+  return v;
+}
+
+Object *ll_eval_len(Context *c, Object *a) {
+  Object *s = ll_next(&a);
+  if (ll_type(s) == D_Vector)
+    return ll_int(c, (long long)ll_to_vector(s)->size);
+  if (ll_type(s) == D_String)
+    return ll_int(c, (long long)strlen(ll_to_string(s)));
+  if (ll_type(s) == D_Builder)
+    return ll_int(c, (long long)ll_to_builder(s)->size);
+  if (ll_type(s) == D_I64Array || ll_type(s) == D_F64Array)
+    return ll_int(c, (long long)ll_to_array(s)->size);
+  long long n = 0;
+  for (; s; ++n)
+    ll_next(&s);
+  return ll_int(c, n);
+}
+
+Object *ll_eval_nth(Context *c, Object *a) {
+  Object *s = ll_next(&a);
+  long long i = ll_to_int(ll_next(&a));
+  assert(i >= 0);
+  if (ll_type(s) == D_Vector) {
+    assert((size_t)i < ll_to_vector(s)->size);
+    return ll_to_vector(s)->items[i];
+  }
+  if (ll_type(s) == D_I64Array || ll_type(s) == D_F64Array) {
+    assert((size_t)i < ll_to_array(s)->size);
+    return ll_type(s) == D_I64Array ? ll_int(c, ll_i64s(s)[i]) : ll_float(c, ll_f64s(s)[i]);
+  }
+  while (i-- > 0)
+    ll_next(&s);
+  return ll_car(s);
+}
+
+/* (map f seq), the result has the type of seq. Like all builtins `f` gets an argument list it must not keep. */
+Object *ll_eval_map(Context *c, Object *a) {
+  Object *fn = ll_next(&a), *s = ll_next(&a);
+  Object *args = ll_cons(c, NULL, NULL);
+  if (ll_type(s) == D_Vector) {
+    Object *r = ll_vector(c, ll_to_vector(s)->size);
+    for (size_t i = 0; i < ll_to_vector(s)->size; ++i) {
+      args->car.ob = ll_to_vector(s)->items[i];
+      ll_to_vector(r)->items[i] = ll_apply(c, fn, args);
+    }
+    return r;
+  }
+  Object *r = NULL, *tail = NULL;
+  while (s) {
+    args->car.ob = ll_next(&s);
+    Object *x = ll_cons(c, ll_apply(c, fn, args), NULL);
+    if (tail)
+      tail->cdr.ob = x;
+    else
+      r = x;
+    tail = x;
+  }
+  return r;
+}
+
+/* (fold f init seq) */
+Object *ll_eval_fold(Context *c, Object *a) {
+  Object *fn = ll_next(&a), *acc = ll_next(&a), *s = ll_next(&a);
+  Object *args = ll_cons(c, NULL, ll_cons(c, NULL, NULL));
+  if (ll_type(s) == D_Vector) {
+    for (size_t i = 0; i < ll_to_vector(s)->size; ++i) {
+      args->car.ob = acc;
+      args->cdr.ob->car.ob = ll_to_vector(s)->items[i];
+      acc = ll_apply(c, fn, args);
+    }
+    return acc;
+  }
+  while (s) {
+    args->car.ob = acc;
+    args->cdr.ob->car.ob = ll_next(&s);
+    acc = ll_apply(c, fn, args);
+  }
+  return acc;
+}
+
+/*
+ * Numeric array kernels. Every kernel exists as portable scalar code and, on x86, as SSE2 and AVX2 variants that are
+ * compiled through target attributes. The best supported set is picked once at runtime from the CPU features, so a
+ * generic build still uses the vector units of the machine it runs on. Results of float reductions may differ from
+ * the scalar order in the last bits.
+ */
+typedef struct ArrayKernels {
+  const char *isa;
+  double (*f64_sum)(const double *a, size_t n);
+  double (*f64_min)(const double *a, size_t n);
+  double (*f64_max)(const double *a, size_t n);
+  double (*f64_dot)(const double *a, const double *b, size_t n);
+  void (*f64_add)(double *r, const double *a, const double *b, size_t n);
+  void (*f64_mul)(double *r, const double *a, const double *b, size_t n);
+  void (*f64_scale)(double *r, const double *a, double k, size_t n);
+  long long (*i64_sum)(const long long *a, size_t n);
+  long long (*i64_min)(const long long *a, size_t n);
+  long long (*i64_max)(const long long *a, size_t n);
+  void (*i64_add)(long long *r, const long long *a, const long long *b, size_t n);
+  long long (*i64_dot)(const long long *a, const long long *b, size_t n);
+  void (*i64_mul)(long long *r, const long long *a, const long long *b, size_t n);
+  void (*i64_scale)(long long *r, const long long *a, long long k, size_t n);
+} ArrayKernels;
+
+static double f64_sum_scalar(const double *a, size_t n) {
+  double s = 0.0;
+  for (size_t i = 0; i < n; ++i)
+    s += a[i];
+  return s;
+}
+static double f64_min_scalar(const double *a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; ++i)
+    m = a[i] < m ? a[i] : m;
+  return m;
+}
+static double f64_max_scalar(const double *a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; ++i)
+    m = a[i] > m ? a[i] : m;
+  return m;
+}
+static double f64_dot_scalar(const double *a, const double *b, size_t n) {
+  double s = 0.0;
+  for (size_t i = 0; i < n; ++i)
+    s += a[i] * b[i];
+  return s;
+}
+static void f64_add_scalar(double *r, const double *a, const double *b, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = a[i] + b[i];
+}
+static void f64_mul_scalar(double *r, const double *a, const double *b, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = a[i] * b[i];
+}
+static void f64_scale_scalar(double *r, const double *a, double k, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = a[i] * k;
+}
+static long long i64_sum_scalar(const long long *a, size_t n) {
+  unsigned long long s = 0;
+  for (size_t i = 0; i < n; ++i)
+    s += (unsigned long long)a[i];
+  return (long long)s;
+}
+static long long i64_min_scalar(const long long *a, size_t n) {
+  long long m = a[0];
+  for (size_t i = 1; i < n; ++i)
+    m = a[i] < m ? a[i] : m;
+  return m;
+}
+static long long i64_max_scalar(const long long *a, size_t n) {
+  long long m = a[0];
+  for (size_t i = 1; i < n; ++i)
+    m = a[i] > m ? a[i] : m;
+  return m;
+}
+static void i64_add_scalar(long long *r, const long long *a, const long long *b, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] + (unsigned long long)b[i]);
+}
+static long long i64_dot_scalar(const long long *a, const long long *b, size_t n) {
+  unsigned long long s = 0;
+  for (size_t i = 0; i < n; ++i)
+    s += (unsigned long long)a[i] * (unsigned long long)b[i];
+  return (long long)s;
+}
+static void i64_mul_scalar(long long *r, const long long *a, const long long *b, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)b[i]);
+}
+static void i64_scale_scalar(long long *r, const long long *a, long long k, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)k);
+}
+
+static const ArrayKernels ll_scalar_kernels = {
+    "scalar",       f64_sum_scalar,   f64_min_scalar, f64_max_scalar, f64_dot_scalar, f64_add_scalar,
+    f64_mul_scalar, f64_scale_scalar, i64_sum_scalar, i64_min_scalar, i64_max_scalar, i64_add_scalar,
+    i64_dot_scalar, i64_mul_scalar,   i64_scale_scalar,
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define LL_X86_KERNELS 1
+
+/* Horizontal reductions of the vector accumulators, the tails are folded in by the caller. */
+__attribute__((target("sse2"))) static double ll_hsum_pd(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+__attribute__((target("avx2"))) static double ll_hsum_pd4(__m256d v) {
+  return ll_hsum_pd(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+__attribute__((target("sse2"))) static double f64_sum_sse2(const double *a, size_t n) {
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+  }
+  double s = ll_hsum_pd(_mm_add_pd(s0, s1));
+  for (; i < n; ++i)
+    s += a[i];
+  return s;
+}
+__attribute__((target("sse2"))) static double f64_min_sse2(const double *a, size_t n) {
+  size_t i = 0;
+  double m = a[0];
+  if (n >= 2) {
+    __m128d v = _mm_loadu_pd(a);
+    for (i = 2; i + 2 <= n; i += 2)
+      v = _mm_min_pd(v, _mm_loadu_pd(a + i));
+    v = _mm_min_sd(v, _mm_unpackhi_pd(v, v));
+    m = _mm_cvtsd_f64(v);
+  }
+  for (; i < n; ++i)
+    m = a[i] < m ? a[i] : m;
+  return m;
+}
+__attribute__((target("sse2"))) static double f64_max_sse2(const double *a, size_t n) {
+  size_t i = 0;
+  double m = a[0];
+  if (n >= 2) {
+    __m128d v = _mm_loadu_pd(a);
+    for (i = 2; i + 2 <= n; i += 2)
+      v = _mm_max_pd(v, _mm_loadu_pd(a + i));
+    v = _mm_max_sd(v, _mm_unpackhi_pd(v, v));
+    m = _mm_cvtsd_f64(v);
+  }
+  for (; i < n; ++i)
+    m = a[i] > m ? a[i] : m;
+  return m;
+}
+__attribute__((target("sse2"))) static double f64_dot_sse2(const double *a, const double *b, size_t n) {
+  __m128d s = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    s = _mm_add_pd(s, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  double r = ll_hsum_pd(s);
+  for (; i < n; ++i)
+    r += a[i] * b[i];
+  return r;
+}
+__attribute__((target("sse2"))) static void f64_add_sse2(double *r, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(r + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  for (; i < n; ++i)
+    r[i] = a[i] + b[i];
+}
+__attribute__((target("sse2"))) static void f64_mul_sse2(double *r, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  for (; i < n; ++i)
+    r[i] = a[i] * b[i];
+}
+__attribute__((target("sse2"))) static void f64_scale_sse2(double *r, const double *a, double k, size_t n) {
+  __m128d vk = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), vk));
+  for (; i < n; ++i)
+    r[i] = a[i] * k;
+}
+__attribute__((target("sse2"))) static long long i64_sum_sse2(const long long *a, size_t n) {
+  __m128i s = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    s = _mm_add_epi64(s, _mm_loadu_si128((const __m128i *)(a + i)));
+  long long t[2];
+  _mm_storeu_si128((__m128i *)t, s);
+  unsigned long long r = (unsigned long long)t[0] + (unsigned long long)t[1];
+  for (; i < n; ++i)
+    r += (unsigned long long)a[i];
+  return (long long)r;
+}
+__attribute__((target("sse2"))) static void i64_add_sse2(long long *r, const long long *a, const long long *b,
+                                                         size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_si128((__m128i *)(r + i), _mm_add_epi64(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                       _mm_loadu_si128((const __m128i *)(b + i))));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] + (unsigned long long)b[i]);
+}
+
+/*
+ * Neither SSE2 nor AVX2 multiply 64 bit lanes, the low halves of the products are put together from three 32 bit
+ * multiplies: lo(x) * lo(y) + ((hi(x) * lo(y) + lo(x) * hi(y)) << 32).
+ */
+__attribute__((target("sse2"))) static __m128i ll_mullo_epi64(__m128i x, __m128i y) {
+  __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y), _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+  return _mm_add_epi64(_mm_mul_epu32(x, y), _mm_slli_epi64(cross, 32));
+}
+__attribute__((target("sse2"))) static long long i64_dot_sse2(const long long *a, const long long *b, size_t n) {
+  __m128i s = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    s = _mm_add_epi64(s, ll_mullo_epi64(_mm_loadu_si128((const __m128i *)(a + i)),
+                                        _mm_loadu_si128((const __m128i *)(b + i))));
+  long long t[2];
+  _mm_storeu_si128((__m128i *)t, s);
+  unsigned long long r = (unsigned long long)t[0] + (unsigned long long)t[1];
+  for (; i < n; ++i)
+    r += (unsigned long long)a[i] * (unsigned long long)b[i];
+  return (long long)r;
+}
+__attribute__((target("sse2"))) static void i64_mul_sse2(long long *r, const long long *a, const long long *b,
+                                                         size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_si128((__m128i *)(r + i), ll_mullo_epi64(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                        _mm_loadu_si128((const __m128i *)(b + i))));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)b[i]);
+}
+__attribute__((target("sse2"))) static void i64_scale_sse2(long long *r, const long long *a, long long k, size_t n) {
+  __m128i vk = _mm_set1_epi64x(k);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_si128((__m128i *)(r + i), ll_mullo_epi64(_mm_loadu_si128((const __m128i *)(a + i)), vk));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)k);
+}
+
+__attribute__((target("avx2"))) static double f64_sum_avx2(const double *a, size_t n) {
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+  }
+  double s = ll_hsum_pd4(_mm256_add_pd(s0, s1));
+  for (; i < n; ++i)
+    s += a[i];
+  return s;
+}
+__attribute__((target("avx2"))) static double f64_min_avx2(const double *a, size_t n) {
+  if (n < 8)
+    return f64_min_sse2(a, n);
+  __m256d v = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4)
+    v = _mm256_min_pd(v, _mm256_loadu_pd(a + i));
+  double t[4];
+  _mm256_storeu_pd(t, v);
+  double m = f64_min_scalar(t, 4);
+  for (; i < n; ++i)
+    m = a[i] < m ? a[i] : m;
+  return m;
+}
+__attribute__((target("avx2"))) static double f64_max_avx2(const double *a, size_t n) {
+  if (n < 8)
+    return f64_max_sse2(a, n);
+  __m256d v = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4)
+    v = _mm256_max_pd(v, _mm256_loadu_pd(a + i));
+  double t[4];
+  _mm256_storeu_pd(t, v);
+  double m = f64_max_scalar(t, 4);
+  for (; i < n; ++i)
+    m = a[i] > m ? a[i] : m;
+  return m;
+}
+__attribute__((target("avx2"))) static double f64_dot_avx2(const double *a, const double *b, size_t n) {
+  __m256d s = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    s = _mm256_add_pd(s, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  double r = ll_hsum_pd4(s);
+  for (; i < n; ++i)
+    r += a[i] * b[i];
+  return r;
+}
+__attribute__((target("avx2"))) static void f64_add_avx2(double *r, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  for (; i < n; ++i)
+    r[i] = a[i] + b[i];
+}
+__attribute__((target("avx2"))) static void f64_mul_avx2(double *r, const double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  for (; i < n; ++i)
+    r[i] = a[i] * b[i];
+}
+__attribute__((target("avx2"))) static void f64_scale_avx2(double *r, const double *a, double k, size_t n) {
+  __m256d vk = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), vk));
+  for (; i < n; ++i)
+    r[i] = a[i] * k;
+}
+__attribute__((target("avx2"))) static long long i64_sum_avx2(const long long *a, size_t n) {
+  __m256i s = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    s = _mm256_add_epi64(s, _mm256_loadu_si256((const __m256i *)(a + i)));
+  long long t[4];
+  _mm256_storeu_si256((__m256i *)t, s);
+  unsigned long long r = 0;
+  for (int j = 0; j < 4; ++j)
+    r += (unsigned long long)t[j];
+  for (; i < n; ++i)
+    r += (unsigned long long)a[i];
+  return (long long)r;
+}
+__attribute__((target("avx2"))) static long long i64_min_avx2(const long long *a, size_t n) {
+  if (n < 8)
+    return i64_min_scalar(a, n);
+  __m256i v = _mm256_loadu_si256((const __m256i *)a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    v = _mm256_blendv_epi8(v, x, _mm256_cmpgt_epi64(v, x));
+  }
+  long long t[4];
+  _mm256_storeu_si256((__m256i *)t, v);
+  long long m = i64_min_scalar(t, 4);
+  for (; i < n; ++i)
+    m = a[i] < m ? a[i] : m;
+  return m;
+}
+__attribute__((target("avx2"))) static long long i64_max_avx2(const long long *a, size_t n) {
+  if (n < 8)
+    return i64_max_scalar(a, n);
+  __m256i v = _mm256_loadu_si256((const __m256i *)a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    v = _mm256_blendv_epi8(v, x, _mm256_cmpgt_epi64(x, v));
+  }
+  long long t[4];
+  _mm256_storeu_si256((__m256i *)t, v);
+  long long m = i64_max_scalar(t, 4);
+  for (; i < n; ++i)
+    m = a[i] > m ? a[i] : m;
+  return m;
+}
+__attribute__((target("avx2"))) static void i64_add_avx2(long long *r, const long long *a, const long long *b,
+                                                         size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *)(r + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                             _mm256_loadu_si256((const __m256i *)(b + i))));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] + (unsigned long long)b[i]);
+}
+
+__attribute__((target("avx2"))) static __m256i ll_mullo_epi64x4(__m256i x, __m256i y) {
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y),
+                                   _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+  return _mm256_add_epi64(_mm256_mul_epu32(x, y), _mm256_slli_epi64(cross, 32));
+}
+__attribute__((target("avx2"))) static long long i64_dot_avx2(const long long *a, const long long *b, size_t n) {
+  __m256i s = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    s = _mm256_add_epi64(s, ll_mullo_epi64x4(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                             _mm256_loadu_si256((const __m256i *)(b + i))));
+  long long t[4];
+  _mm256_storeu_si256((__m256i *)t, s);
+  unsigned long long r = 0;
+  for (int j = 0; j < 4; ++j)
+    r += (unsigned long long)t[j];
+  for (; i < n; ++i)
+    r += (unsigned long long)a[i] * (unsigned long long)b[i];
+  return (long long)r;
+}
+__attribute__((target("avx2"))) static void i64_mul_avx2(long long *r, const long long *a, const long long *b,
+                                                         size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *)(r + i), ll_mullo_epi64x4(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                             _mm256_loadu_si256((const __m256i *)(b + i))));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)b[i]);
+}
+__attribute__((target("avx2"))) static void i64_scale_avx2(long long *r, const long long *a, long long k, size_t n) {
+  __m256i vk = _mm256_set1_epi64x(k);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *)(r + i), ll_mullo_epi64x4(_mm256_loadu_si256((const __m256i *)(a + i)), vk));
+  for (; i < n; ++i)
+    r[i] = (long long)((unsigned long long)a[i] * (unsigned long long)k);
+}
+
+static const ArrayKernels ll_sse2_kernels = {
+    "sse2",       f64_sum_sse2,   f64_min_sse2, f64_max_sse2,   f64_dot_sse2,   f64_add_sse2,
+    f64_mul_sse2, f64_scale_sse2, i64_sum_sse2, i64_min_scalar, i64_max_scalar, i64_add_sse2,
+    i64_dot_sse2, i64_mul_sse2,   i64_scale_sse2,
+};
+
+static const ArrayKernels ll_avx2_kernels = {
+    "avx2",       f64_sum_avx2,   f64_min_avx2, f64_max_avx2, f64_dot_avx2, f64_add_avx2,
+    f64_mul_avx2, f64_scale_avx2, i64_sum_avx2, i64_min_avx2, i64_max_avx2, i64_add_avx2,
+    i64_dot_avx2, i64_mul_avx2,   i64_scale_avx2,
+};
+#endif
+
+static const ArrayKernels *ll_kernels(void) {
+  static const ArrayKernels *k = NULL;
+  if (!k) {
+    k = &ll_scalar_kernels;
+#ifdef LL_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      k = &ll_avx2_kernels;
+    else if (__builtin_cpu_supports("sse2"))
+      k = &ll_sse2_kernels;
+#endif
+  }
+  return k;
+}
+
+/* (i64-array x...) or (f64-array x...), a single vector argument is converted element by element. */
+static Object *ll_make_array(Context *c, DataType dt, Object *a) {
+  Object **items = NULL;
+  size_t n = 0;
+  if (a && !ll_cdr(a) && ll_type(ll_car(a)) == D_Vector) {
+    items = ll_to_vector(ll_car(a))->items;
+    n = ll_to_vector(ll_car(a))->size;
+  } else {
+    for (Object *x = a; x; x = ll_cdr(x))
+      ++n;
+  }
+  Object *r = ll_array(c, dt, n);
+  for (size_t i = 0; i < n; ++i) {
+    Object *x = items ? items[i] : ll_next(&a);
+    if (dt == D_I64Array) {
+      ll_i64s(r)[i] = ll_to_int(x);
+    } else {
+      assert(ll_type(x) == D_Int || ll_type(x) == D_Float);
+      ll_f64s(r)[i] = ll_type(x) == D_Int ? (double)ll_to_int(x) : ll_to_float(x);
+    }
+  }
+  return r;
+}
+
+Object *ll_eval_i64_array(Context *c, Object *a) { return ll_make_array(c, D_I64Array, a); }
+Object *ll_eval_f64_array(Context *c, Object *a) { return ll_make_array(c, D_F64Array, a); }
+
+Object *ll_eval_sum(Context *c, Object *a) {
+  Object *x = ll_next(&a);
+  size_t n = ll_to_array(x)->size;
+  if (ll_type(x) == D_I64Array)
+    return ll_int(c, ll_kernels()->i64_sum(ll_i64s(x), n));
+  return ll_float(c, ll_kernels()->f64_sum(ll_f64s(x), n));
+}
+
+Object *ll_eval_min(Context *c, Object *a) {
+  Object *x = ll_next(&a);
+  size_t n = ll_to_array(x)->size;
+  assert(n > 0);
+  if (ll_type(x) == D_I64Array)
+    return ll_int(c, ll_kernels()->i64_min(ll_i64s(x), n));
+  return ll_float(c, ll_kernels()->f64_min(ll_f64s(x), n));
+}
+
+Object *ll_eval_max(Context *c, Object *a) {
+  Object *x = ll_next(&a);
+  size_t n = ll_to_array(x)->size;
+  assert(n > 0);
+  if (ll_type(x) == D_I64Array)
+    return ll_int(c, ll_kernels()->i64_max(ll_i64s(x), n));
+  return ll_float(c, ll_kernels()->f64_max(ll_f64s(x), n));
+}
+
+/* Elementwise builtins take two arrays of the same type and length. */
+static size_t ll_array_pair(Object *x, Object *y) {
+  assert(ll_type(x) == ll_type(y) && ll_to_array(x)->size == ll_to_array(y)->size);
+  return ll_to_array(x)->size;
+}
+
+/* (dot a b), 64 bit integer products wrap around like `+`. */
+Object *ll_eval_dot(Context *c, Object *a) {
+  Object *x = ll_next(&a), *y = ll_next(&a);
+  size_t n = ll_array_pair(x, y);
+  if (ll_type(x) == D_F64Array)
+    return ll_float(c, ll_kernels()->f64_dot(ll_f64s(x), ll_f64s(y), n));
+  return ll_int(c, ll_kernels()->i64_dot(ll_i64s(x), ll_i64s(y), n));
+}
+
+Object *ll_eval_array_add(Context *c, Object *a) {
+  Object *x = ll_next(&a), *y = ll_next(&a);
+  size_t n = ll_array_pair(x, y);
+  Object *r = ll_array(c, ll_type(x), n);
+  if (ll_type(x) == D_I64Array)
+    ll_kernels()->i64_add(ll_i64s(r), ll_i64s(x), ll_i64s(y), n);
+  else
+    ll_kernels()->f64_add(ll_f64s(r), ll_f64s(x), ll_f64s(y), n);
+  return r;
+}
+
+Object *ll_eval_array_mul(Context *c, Object *a) {
+  Object *x = ll_next(&a), *y = ll_next(&a);
+  size_t n = ll_array_pair(x, y);
+  Object *r = ll_array(c, ll_type(x), n);
+  if (ll_type(x) == D_F64Array)
+    ll_kernels()->f64_mul(ll_f64s(r), ll_f64s(x), ll_f64s(y), n);
+  else
+    ll_kernels()->i64_mul(ll_i64s(r), ll_i64s(x), ll_i64s(y), n);
+  return r;
+}
+
+/* (scale a k), an integer array is only scaled by an integer. */
+Object *ll_eval_scale(Context *c, Object *a) {
+  Object *x = ll_next(&a), *k = ll_next(&a);
+  size_t n = ll_to_array(x)->size;
+  Object *r = ll_array(c, ll_type(x), n);
+  if (ll_type(x) == D_F64Array) {
+    assert(ll_type(k) == D_Int || ll_type(k) == D_Float);
+    ll_kernels()->f64_scale(ll_f64s(r), ll_f64s(x), ll_type(k) == D_Int ? (double)ll_to_int(k) : ll_to_float(k), n);
+  } else {
+    ll_kernels()->i64_scale(ll_i64s(r), ll_i64s(x), ll_to_int(k), n);
+  }
+  return r;
+}
+
+/*
+ * Parallel map and reduce. (pmap f seq) and (preduce f init seq) split their input into one slice per worker thread.
+ * A worker evaluates with a context of its own on top of the caller's globals and allocates from a private
+ * collector, whose stack scan covers just the worker thread. The shared input and the globals are only read: the
+ * caller is blocked until all workers joined, so nothing in its heap is collected or changed meanwhile, and `f` must
+ * not define globals. Results are deep copied into the caller's heap before the worker heaps are dropped.
+ *
+ * The workers run on a pool of threads that is started on first use and kept for later calls, the calling thread
+ * takes a share of the work as well. A call made while the pool is busy, from inside a worker or from another thread,
+ * runs all of its workers on the calling thread.
+ *
+ * preduce folds every slice without `init`, starting from its first element, and folds the partial results into
+ * `init` afterwards, so `f` has to be associative.
+ *
+ * A worker heap has the heap limit of the caller. A worker that runs out of memory stops, and the call fails like an
+ * allocation of the caller once all workers are done and their heaps are dropped.
+ */
+#define LL_MAX_WORKERS 16
+
+static size_t ll_workers = 0; // 0 uses one worker per online CPU
+
+void ll_set_workers(size_t n) { ll_workers = n; }
+
+typedef struct Worker {
+  Object *defined_symbols, *fn;
+  Object *const *items;
+  size_t count;
+  bool reduce;
+  size_t heap_limit;
+  Object *result; // a vector of results or the partial reduction, allocated in `heap`
+  bool failed;    // ran out of memory, `result` is NULL
+  GarbageCollector heap;
+} Worker;
+
+static void ll_worker_run(Worker *w) {
+  Context c = {w->defined_symbols, NULL, 0, 0, NULL, 0, NULL, NULL};
+  Object *r;
+  if (w->reduce) {
+    r = w->items[0];
+    for (size_t i = 1; i < w->count; ++i)
+      r = ll_apply(&c, w->fn, ll_cons(&c, r, ll_cons(&c, w->items[i], NULL)));
+  } else {
+    r = ll_vector(&c, w->count);
+    for (size_t i = 0; i < w->count; ++i)
+      ll_to_vector(r)->items[i] = ll_apply(&c, w->fn, ll_cons(&c, w->items[i], NULL));
+  }
+  w->result = r;
+}
+
+/* Runs a worker on the current thread, allocation failures unwind to here and not to an evaluation of the caller. */
+static void *ll_worker_main(void *arg) {
+  Worker *w = (Worker *)arg;
+  GarbageCollector *home = ll_heap;
+  jmp_buf failure, *outer = ll_failure;
+  gc_start(&w->heap, __builtin_frame_address(0)); // above all locals, a spilled `w` may not be
+  gc_heap_limit(&w->heap, w->heap_limit);
+  ll_heap = &w->heap;
+  ll_failure = &failure;
+  if (!setjmp(failure)) {
+    ll_worker_run(w);
+  } else {
+    w->result = NULL;
+    w->failed = true;
+  }
+  ll_failure = outer;
+  ll_heap = home;
+  return NULL;
+}
+
+/*
+ * Copies of worker results. The map forwards every copied object to its copy, so shared structure stays shared and
+ * cycles terminate. It lives in malloc memory, the caller's collector is paused while copying.
+ */
+typedef struct CopyMap {
+  GarbageCollector *from;
+  Object **keys, **copies;
+  size_t count, cap;
+} CopyMap;
+
+static Object *ll_copy_find(CopyMap *m, Object *o) {
+  if (!m->cap)
+    return NULL;
+  for (size_t j = ll_ptr_hash(o) & (m->cap - 1); m->keys[j]; j = (j + 1) & (m->cap - 1))
+    if (m->keys[j] == o)
+      return m->copies[j];
+  return NULL;
+}
+
+static void ll_copy_put(CopyMap *m, Object *o, Object *r) {
+  if (2 * (m->count + 1) > m->cap) {
+    CopyMap g = {m->from, NULL, NULL, 0, m->cap ? m->cap * 2 : 64};
+    g.keys = (Object **)calloc(g.cap, sizeof(Object *));
+    g.copies = (Object **)malloc(g.cap * sizeof(Object *));
+    assert(g.keys && g.copies);
+    for (size_t i = 0; i < m->cap; ++i)
+      if (m->keys[i])
+        ll_copy_put(&g, m->keys[i], m->copies[i]);
+    free(m->keys);
+    free(m->copies);
+    *m = g;
+  }
+  size_t j = ll_ptr_hash(o) & (m->cap - 1);
+  while (m->keys[j])
+    j = (j + 1) & (m->cap - 1);
+  m->keys[j] = o;
+  m->copies[j] = r;
+  m->count++;
+}
+
+static void ll_copy_free(CopyMap *m) {
+  free(m->keys);
+  free(m->copies);
+}
+
+/* Copies the parts of `o` allocated in `m->from` into the current heap, everything else is shared. */
+static Object *ll_copy(Context *c, Object *o, CopyMap *m) {
+  if (!o || ll_immediate(o) || !gc_owns(m->from, o))
+    return o;
+  Object *r = ll_copy_find(m, o);
+  if (r)
+    return r;
+  // every copy is entered into the map before its fields are copied
+  switch (ll_type_internal(o)) {
+  case D_List: {
+    Object *tail = r = ll_cons(c, NULL, NULL);
+    ll_copy_put(m, o, r);
+    r->car.ob = ll_copy(c, o->car.ob, m);
+    for (o = o->cdr.ob; o && !ll_immediate(o) && ll_type_internal(o) == D_List && gc_owns(m->from, o) &&
+                        !ll_copy_find(m, o);
+         o = o->cdr.ob) {
+      tail = tail->cdr.ob = ll_cons(c, NULL, NULL);
+      ll_copy_put(m, o, tail);
+      tail->car.ob = ll_copy(c, o->car.ob, m);
+    }
+    tail->cdr.ob = ll_copy(c, o, m);
+    return r;
+  }
+  case D_LongSymbol:
+  case D_LongString:
+    r = ll_malloc(c, ll_type_internal(o));
+    ll_set_text_(r, o->cdr.lt, strlen(o->cdr.lt));
+    break;
+  case D_Vector:
+    r = ll_vector(c, ll_to_vector(o)->size);
+    ll_copy_put(m, o, r);
+    for (size_t i = 0; i < ll_to_vector(o)->size; ++i)
+      ll_to_vector(r)->items[i] = ll_copy(c, ll_to_vector(o)->items[i], m);
+    return r;
+  case D_I64Array:
+  case D_F64Array:
+    r = ll_array(c, ll_type_internal(o), ll_to_array(o)->size);
+    memcpy(ll_to_array(r) + 1, ll_to_array(o) + 1, ll_to_array(o)->size * sizeof(double));
+    break;
+  case D_Closure:
+    r = ll_malloc(c, D_Closure);
+    r->cdr.ob = NULL;
+    ll_copy_put(m, o, r);
+    r->cdr.ob = ll_copy(c, o->cdr.ob, m);
+    return r;
+  case D_Builder:
+    r = ll_builder(c);
+    ll_builder_append(r, ll_to_builder(o)->text, ll_to_builder(o)->size);
+    break;
+  case D_Table:
+    r = ll_table(c);
+    ll_copy_put(m, o, r);
+    for (size_t i = 0; i < ll_to_table(o)->cap; ++i) {
+      Object **p = ll_to_table(o)->pairs + 2 * i;
+      if (ll_table_live(p[0]))
+        ll_table_set(r, ll_copy(c, p[0], m), ll_copy(c, p[1], m));
+    }
+    return r;
+  case D_Weak:
+    r = ll_weak(c, NULL);
+    ll_copy_put(m, o, r);
+    *(Object **)r->cdr.cd = ll_copy(c, ll_weak_get(o), m);
+    return r;
+  case D_Code:
+  case D_Continuation:
+    assert(!"cannot copy compiled code or continuations out of a worker");
+    return NULL;
+  case D_OwnedCData:
+    assert(!"cannot copy owned native data out of a worker, its resource is released with the worker heap");
+    return NULL;
+  default:
+    r = ll_malloc(c, ll_type_internal(o));
+    r->cdr = o->cdr;
+  }
+  ll_copy_put(m, o, r);
+  return r;
+}
+
+typedef struct WorkerPool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready, done;
+  size_t threads; // pool threads started so far
+  Worker *jobs;   // the batch being worked on, NULL while the pool is idle
+  size_t count, next, running;
+} WorkerPool;
+
+static WorkerPool ll_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+/* Works on the current batch until it has no jobs left, the pool lock is held. */
+static void ll_pool_work(WorkerPool *p) {
+  while (p->jobs && p->next < p->count) {
+    Worker *w = &p->jobs[p->next++];
+    p->running++;
+    pthread_mutex_unlock(&p->lock);
+    ll_worker_main(w);
+    pthread_mutex_lock(&p->lock);
+    if (--p->running == 0 && p->next == p->count)
+      pthread_cond_broadcast(&p->done);
+  }
+}
+
+static void *ll_pool_main(void *arg) {
+  WorkerPool *p = (WorkerPool *)arg;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    ll_pool_work(p);
+    pthread_cond_wait(&p->ready, &p->lock);
+  }
+  return NULL;
+}
+
+/* Runs `fn` over `items` on up to LL_MAX_WORKERS workers, returns the number of workers used. */
+static size_t ll_parallel(Context *c, Object *fn, Object *const *items, size_t n, bool reduce, Worker *w) {
+  size_t k = ll_workers ? ll_workers : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  k = k < 1 ? 1 : k > LL_MAX_WORKERS ? LL_MAX_WORKERS : k;
+  k = k > n ? n : k;
+  ll_kernels(); // initialize lazily computed tables before they are shared
+  for (size_t i = 0, begin = 0; i < k; ++i) {
+    size_t end = begin + (n - begin) / (k - i);
+    w[i] = (Worker){0};
+    w[i].defined_symbols = c->defined_symbols;
+    w[i].fn = ll_type(fn) == D_Symbol ? ll_defined_symbol(c, ll_to_symbol(fn)) : fn;
+    w[i].items = items + begin;
+    w[i].count = end - begin;
+    w[i].reduce = reduce;
+    w[i].heap_limit = ll_heap->heap_limit;
+    begin = end;
+  }
+
+  WorkerPool *p = &ll_pool;
+  pthread_mutex_lock(&p->lock);
+  if (p->jobs) {
+    pthread_mutex_unlock(&p->lock);
+    for (size_t i = 0; i < k; ++i)
+      ll_worker_main(&w[i]);
+    return k;
+  }
+  pthread_t thread;
+  while (p->threads + 1 < k && pthread_create(&thread, NULL, ll_pool_main, p) == 0) {
+    pthread_detach(thread);
+    p->threads++;
+  }
+  p->jobs = w;
+  p->count = k;
+  p->next = 0;
+  pthread_cond_broadcast(&p->ready);
+  ll_pool_work(p); // without pool threads, all jobs run here
+  while (p->running)
+    pthread_cond_wait(&p->done, &p->lock);
+  p->jobs = NULL;
+  pthread_mutex_unlock(&p->lock);
+  return k;
+}
+
+/* Collects the elements of a list or vector, lists are copied into `*tmp` which has to be released with gc_free. */
+static Object *const *ll_elements(Object *s, size_t *n, Object ***tmp) {
+  *tmp = NULL;
+  if (ll_type(s) == D_Vector) {
+    *n = ll_to_vector(s)->size;
+    return ll_to_vector(s)->items;
+  }
+  *n = 0;
+  for (Object *x = s; x; x = ll_cdr(x))
+    ++*n;
+  *tmp = (Object **)ll_checked(gc_malloc(ll_heap, (*n ? *n : 1) * sizeof(Object *)));
+  for (size_t i = 0; s; ++i)
+    (*tmp)[i] = ll_next(&s);
+  return *tmp;
+}
+
+/*
+ * Copies the results of `k` workers to `out` in the heap of the caller and drops the worker heaps, a map worker
+ * contributes one element per item and a reduce worker its partial result. Fails like an allocation if a worker or
+ * the copy ran out of memory, after the worker heaps and `tmp` are released.
+ */
+static void ll_gather(Context *c, Worker *w, size_t k, Object **out, Object **tmp) {
+  jmp_buf failure, *outer = ll_failure;
+  CopyMap maps[LL_MAX_WORKERS] = {{0}};
+  bool failed = false, paused = ll_heap->paused;
+  for (size_t i = 0; i < k; ++i)
+    failed |= w[i].failed;
+  gc_pause(ll_heap);
+  ll_failure = &failure;
+  if (!failed && !setjmp(failure)) {
+    for (size_t i = 0, j = 0; i < k; ++i) {
+      maps[i].from = &w[i].heap;
+      if (w[i].reduce)
+        out[j++] = ll_copy(c, w[i].result, &maps[i]);
+      for (size_t e = 0; !w[i].reduce && e < w[i].count; ++e)
+        out[j++] = ll_copy(c, ll_to_vector(w[i].result)->items[e], &maps[i]);
+    }
+  } else {
+    failed = true;
+  }
+  ll_failure = outer;
+  if (!paused)
+    gc_resume(ll_heap);
+  for (size_t i = 0; i < k; ++i) {
+    ll_copy_free(&maps[i]);
+    gc_stop(&w[i].heap);
+  }
+  if (tmp)
+    gc_free(ll_heap, tmp);
+  if (failed)
+    ll_out_of_memory();
+}
+
+/* (pmap f seq), like `map` the result has the type of seq. */
+Object *ll_eval_pmap(Context *c, Object *a) {
+  Object *fn = ll_next(&a), *s = ll_next(&a);
+  Object **tmp;
+  size_t n;
+  Object *const *items = ll_elements(s, &n, &tmp);
+  Object *r = ll_vector(c, n);
+  Worker w[LL_MAX_WORKERS];
+  size_t k = n ? ll_parallel(c, fn, items, n, false, w) : 0;
+  ll_gather(c, w, k, ll_to_vector(r)->items, tmp);
+
+  if (ll_type(s) == D_Vector)
+    return r;
+  Object *l = NULL;
+  for (size_t i = n; i-- > 0;)
+    l = ll_cons(c, ll_to_vector(r)->items[i], l);
+  return l;
+}
+
+/* (preduce f init seq) */
+Object *ll_eval_preduce(Context *c, Object *a) {
+  Object *fn = ll_next(&a), *acc = ll_next(&a), *s = ll_next(&a);
+  Object **tmp;
+  size_t n;
+  Object *const *items = ll_elements(s, &n, &tmp);
+  Worker w[LL_MAX_WORKERS];
+  size_t k = n ? ll_parallel(c, fn, items, n, true, w) : 0;
+  Object *partials[LL_MAX_WORKERS];
+  ll_gather(c, w, k, partials, tmp);
+
+  for (size_t i = 0; i < k; ++i)
+    acc = ll_apply(c, fn, ll_cons(c, acc, ll_cons(c, partials[i], NULL)));
+  return acc;
+}
+
+/*
+ * Registration table of all builtins. Snapshots refer to CFuncs by these names, so entries must keep their name once
+ * snapshots of contexts are stored anywhere.
+ */
+typedef struct Builtin {
+  const char *name;
+  CFunc fn;
+} Builtin;
+
+static const Builtin ll_builtins[] = {
+    {"+", ll_eval_add},
+    {"vec", ll_eval_vec},
+    {"len", ll_eval_len},
+    {"nth", ll_eval_nth},
+    {"map", ll_eval_map},
+    {"fold", ll_eval_fold},
+    {"i64-array", ll_eval_i64_array},
+    {"f64-array", ll_eval_f64_array},
+    {"sum", ll_eval_sum},
+    {"min", ll_eval_min},
+    {"max", ll_eval_max},
+    {"dot", ll_eval_dot},
+    {"add", ll_eval_array_add},
+    {"mul", ll_eval_array_mul},
+    {"scale", ll_eval_scale},
+    {"-", ll_eval_sub},
+    {"*", ll_eval_mul},
+    {"/", ll_eval_div},
+    {"<", ll_eval_lt},
+    {"=", ll_eval_eq},
+    {">", ll_eval_gt},
+    {"<=", ll_eval_le},
+    {">=", ll_eval_ge},
+    {"pmap", ll_eval_pmap},
+    {"preduce", ll_eval_preduce},
+    {"builder", ll_eval_builder},
+    {"append", ll_eval_append},
+    {"str", ll_eval_str},
+    {"substring", ll_eval_substring},
+    {"join", ll_eval_join},
+    {"table", ll_eval_table},
+    {"table-get", ll_eval_table_get},
+    {"table-set", ll_eval_table_set},
+    {"table-delete", ll_eval_table_delete},
+    {"table-count", ll_eval_table_count},
+    {"weak", ll_eval_weak},
+    {"weak-get", ll_eval_weak_get},
+};
+
+#define LL_BUILTIN_COUNT (sizeof(ll_builtins) / sizeof(Builtin))
+
+/* Registers the objects held by a context as precise roots of the current heap. */
+static void ll_root_context(Context *c, bool add) {
+  void **slots[] = {(void **)&c->defined_symbols, (void **)&c->stack, (void **)&c->form, (void **)&c->optimized,
+                    &c->snapshot};
+  for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); ++i)
+    (add ? gc_add_root : gc_remove_root)(ll_heap, slots[i]);
+}
+
+void ll_init_context(Context *c) {
+  ll_globals_version++;
+  c->defined_symbols = NULL;
+  c->stack = NULL;
+  c->depth = c->stack_cap = 0;
+  c->form = NULL;
+  c->pinned = 0;
+  c->optimized = NULL;
+  c->snapshot = NULL;
+  ll_root_context(c, true);
+  for (size_t i = LL_BUILTIN_COUNT; i-- > 0;) {
+    Object *global = ll_cons(c, ll_symbol(c, ll_builtins[i].name), ll_cfunc(c, ll_builtins[i].fn));
+    c->defined_symbols = ll_cons(c, global, c->defined_symbols);
+  }
+}
+
+void ll_free_context(Context *c) {
+  ll_root_context(c, false);
+  ll_globals_version++;
+  c->defined_symbols = NULL;
+  if (c->stack)
+    gc_free(ll_heap, c->stack);
+  c->stack = NULL;
+  c->depth = c->stack_cap = 0;
+  c->form = NULL;
+  c->optimized = NULL;
+  if (c->snapshot)
+    gc_free(ll_heap, c->snapshot);
+  c->snapshot = NULL;
+}
+
+/* Names the call being evaluated as operator@line:column for the heap profiler. */
+static const char *ll_profile_label(void *data) {
+  static __thread char label[96];
+  Object *form = ((Context *)data)->form;
+  if (!form)
+    return NULL;
+  Object *op = ll_car(form);
+  const char *name = ll_type(op) == D_Symbol ? ll_to_symbol(op) : "?";
+  for (size_t i = 0; ll_type(op) == D_CFunc && i < LL_BUILTIN_COUNT; ++i)
+    if (ll_builtins[i].fn == ll_to_cfunc(op))
+      name = ll_builtins[i].name;
+  Location l;
+  if (ll_location(form, &l))
+    snprintf(label, sizeof(label), "%s@%u:%u", name, (unsigned)l_line(l), (unsigned)l_column(l));
+  else
+    snprintf(label, sizeof(label), "%s", name);
+  return label;
+}
+
+/* Samples the allocations of the current heap about every `interval` bytes, see gc_profile_start. */
+void ll_profile_start(Context *c, size_t interval, FILE *report) {
+  gc_profile_start(ll_heap, interval, report);
+  gc_profile_label(ll_heap, ll_profile_label, c);
+}
+
+/* Returns the (symbol . value) binding of a global, the binding stays valid as long as the global is defined. */
+Object *ll_defined_binding(Context *c, const char *sym) {
+  Object *x = c->defined_symbols;
+  while (x) {
+    Object *p = ll_next(&x);
+    if (strcmp(ll_to_symbol(ll_car(p)), sym) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+Object *ll_defined_symbol(Context *c, const char *sym) {
+  Object *p = ll_defined_binding(c, sym);
+  return p ? ll_cdr(p) : NULL;
+}
+
+/* Reports an evaluation error on stderr, prefixed with the source location of `o` if it was read from text. */
+static void ll_report(Object *o, const char *msg, const char *detail) {
+  Location l;
+  if (ll_location(o, &l))
+    fprintf(stderr, "%u:%u: %s %s\n", l_line(l), l_column(l), msg, detail);
+  else
+    fprintf(stderr, "%s %s\n", msg, detail);
+}
+
+/*
+ * Evaluation. `ll_eval` is a CEK style machine: instead of recursing on the C stack it keeps the pending work as
+ * frames on an explicit continuation stack in the context. Evaluating a form either produces a value or pushes a
+ * frame and continues with a subform, a value is handed to the innermost frame. Calls of closures pop their frame
+ * before the body is entered, so calls in tail position run in constant space. The stack is a gc allocation, its
+ * frames keep intermediate values reachable, while the C stack the collector scans stays flat.
+ *
+ * The machine also works with a heap that does not scan the C stack: its state is registered as precise roots and it
+ * collects at a safepoint before each argument is pushed. Builtins hold objects in C locals the collector does not
+ * know of, so while one runs the context is pinned and the evaluations it starts do not collect: without stack scanning
+ * a long-running builtin grows the heap until it returns.
+ *
+ * Symbols evaluate to their local binding, then to their global definition and otherwise to themselves. The special
+ * forms are (if c then else), (lambda (params...) body...) and (define name value).
+ */
+typedef enum FrameKind {
+  K_CALL,   // evaluating the operator and arguments of `form`
+  K_IF,     // waiting for the condition, `form` holds (then else)
+  K_SEQ,    // `form` holds the body forms still to evaluate
+  K_DEFINE, // waiting for the value of the global `form`
+} FrameKind;
+
+struct Frame {
+  FrameKind kind;
+  Object *form, *env;
+  Object *rest;        // argument forms still to evaluate
+  Object *head, *tail; // evaluated operator and arguments so far
+};
+
+static void ll_push(Context *c, FrameKind kind, Object *form, Object *env) {
+  if (c->depth == c->stack_cap) {
+    size_t cap = c->stack_cap ? 2 * c->stack_cap : 64;
+    c->stack = (Frame *)ll_checked(gc_realloc(ll_heap, c->stack, cap * sizeof(Frame)));
+    c->stack_cap = cap;
+  }
+  c->stack[c->depth++] = (Frame){kind, form, env, NULL, NULL, NULL};
+}
+
+static Frame ll_pop(Context *c) {
+  Frame f = c->stack[--c->depth];
+  c->stack[c->depth] = (Frame){0}; // popped frames must not keep their values alive
+  return f;
+}
+
+/* Resolves `sym`, if it is the operator of call `site` a global binding is taken from and stored in its cache. */
+static Object *ll_lookup(Context *c, Object *env, Object *sym, Object *site) {
+  const char *name = ll_to_symbol(sym);
+  for (Object *e = env; e; e = e->cdr.ob)
+    if (strcmp(ll_to_symbol(e->car.ob->car.ob), name) == 0)
+      return e->car.ob->cdr.ob;
+  CallCache *k = site && ll_heap == &gc ? ll_call_cache(site) : NULL; // the cache table is not shared with workers
+  if (k && k->c == c && k->version == ll_globals_version)
+    return ll_cdr(k->binding);
+  Object *p = ll_defined_binding(c, name);
+  if (k && p)
+    *k = (CallCache){c, p, ll_globals_version};
+  return p ? ll_cdr(p) : sym;
+}
+
+void ll_define(Context *c, Object *sym, Object *v) {
+  assert(ll_heap == &gc && "globals cannot be defined by pmap workers");
+  Object *p = ll_defined_binding(c, ll_to_symbol(sym));
+  if (p && ll_type(p->cdr.ob) == D_CFunc)
+    ll_globals_version++;
+  if (p)
+    p->cdr.ob = v;
+  else
+    c->defined_symbols = ll_cons(c, ll_cons(c, sym, v), c->defined_symbols);
+}
+
+static bool ll_special(Object *o, const char *name) {
+  Object *head = ll_car(o);
+  return ll_type(head) == D_Symbol && strcmp(ll_to_symbol(head), name) == 0;
+}
+
+/* Binds the parameters of closure `fn` to `args` in a new environment `env` and returns the body forms. */
+static Object *ll_closure_enter(Context *c, Object *fn, Object *args, Object **env) {
+  Object *lambda = ll_car(fn->cdr.ob), *params = ll_car(ll_cdr(lambda));
+  Object *e = ll_cdr(fn->cdr.ob);
+  while (params && args)
+    e = ll_cons(c, ll_cons(c, ll_next(&params), ll_next(&args)), e);
+  if (params || args)
+    ll_report(lambda, "wrong number of arguments for", "lambda");
+  assert(!params && !args);
+  *env = e;
+  return ll_cdr(ll_cdr(lambda));
+}
+
+/*
+ * Resumable evaluation. A fuelled evaluation that runs out of steps moves its frames off the context stack into a
+ * continuation object together with the machine registers, `ll_resume` pushes them back and carries on. A step is
+ * the evaluation of one form, builtins are atomic, so closures called from builtins like `map` run to completion
+ * within the step of their caller. Continuations are one-shot: argument lists under construction live in the frames
+ * and are completed in place.
+ */
+typedef struct Continuation {
+  Object *o, *env, *v;
+  bool eval, resumed;
+  size_t depth;
+  Frame frames[];
+} Continuation;
+
+static Object *ll_suspend(Context *c, size_t base, Object *o, Object *env, Object *v, bool eval) {
+  size_t depth = c->depth - base;
+  Continuation *k = (Continuation *)ll_checked(gc_malloc(ll_heap, sizeof(Continuation) + depth * sizeof(Frame)));
+  *k = (Continuation){o, env, v, eval, false, depth};
+  memcpy(k->frames, c->stack + base, depth * sizeof(Frame));
+  while (c->depth > base)
+    ll_pop(c);
+  Object *r = ll_malloc(c, D_Continuation);
+  r->cdr.cd = k;
+  return r;
+}
+
+/* Runs the machine on top of the frames above `base` until they are done or `fuel` evaluation steps are used up. */
+static Object *ll_eval_steps(Context *c, size_t base, Object *o, Object *env, Object *v, bool eval, size_t fuel) {
+  GC_ROOT(ll_heap, o);
+  GC_ROOT(ll_heap, env);
+  GC_ROOT(ll_heap, v);
+  for (;;) {
+    if (eval && fuel-- == 0)
+      return ll_suspend(c, base, o, env, v, eval);
+    if (eval) {
+      eval = false;
+      if (ll_type(o) == D_Symbol) {
+        v = ll_lookup(c, env, o, NULL);
+      } else if (ll_type(o) != D_List) {
+        v = o;
+      } else if (ll_special(o, "if")) {
+        Object *a = ll_cdr(o);
+        o = ll_next(&a);
+        ll_push(c, K_IF, a, env);
+        eval = true;
+      } else if (ll_special(o, "lambda")) {
+        v = ll_closure(c, o, env);
+      } else if (ll_special(o, "define")) {
+        Object *a = ll_cdr(o), *sym = ll_next(&a);
+        if (ll_type(sym) != D_Symbol)
+          ll_report(o, "define expects a symbol", "");
+        assert(ll_type(sym) == D_Symbol);
+        ll_push(c, K_DEFINE, sym, env);
+        o = a ? ll_car(a) : NULL;
+        eval = true;
+      } else {
+        ll_push(c, K_CALL, o, env);
+        c->stack[c->depth - 1].rest = ll_cdr(o);
+        c->form = o;
+        if (ll_type(ll_car(o)) == D_Symbol) {
+          v = ll_lookup(c, env, ll_car(o), o);
+        } else {
+          o = ll_car(o);
+          eval = true;
+        }
+      }
+      continue;
+    }
+
+    if (c->depth == base)
+      return v;
+    Frame *f = &c->stack[c->depth - 1];
+    switch (f->kind) {
+    case K_CALL: {
+      if (!c->pinned && !ll_heap->scan_stack)
+        gc_safepoint(ll_heap);
+      c->form = f->form;
+      Object *x = ll_cons(c, v, NULL);
+      if (f->tail)
+        f->tail->cdr.ob = x;
+      else
+        f->head = x;
+      f->tail = x;
+      if (f->rest) {
+        o = ll_next(&f->rest);
+        env = f->env;
+        eval = true;
+        break;
+      }
+      Frame call = ll_pop(c);
+      Object *fn = ll_car(call.head), *args = ll_cdr(call.head);
+      if (ll_type(fn) == D_CFunc) {
+        c->pinned++;
+        v = ll_to_cfunc(fn)(c, args);
+        c->pinned--;
+        break;
+      }
+      if (ll_type(fn) != D_Closure) {
+        Object *op = ll_car(call.form);
+        bool undefined = ll_type(fn) == D_Symbol;
+        ll_report(call.form, undefined ? "undefined symbol:" : "not a function:",
+                  ll_type(op) == D_Symbol ? ll_to_symbol(op) : "");
+      }
+      assert(ll_type(fn) == D_Closure);
+      Object *body = ll_closure_enter(c, fn, args, &env);
+      if (body && ll_cdr(body))
+        ll_push(c, K_SEQ, ll_cdr(body), env);
+      o = body ? ll_car(body) : NULL;
+      eval = true;
+      break;
+    }
+    case K_IF: {
+      Frame cond = ll_pop(c);
+      Object *branches = cond.form;
+      if (v == NULL || v == LL_FALSE)
+        branches = branches ? ll_cdr(branches) : NULL;
+      o = branches ? ll_car(branches) : NULL;
+      env = cond.env;
+      eval = true;
+      break;
+    }
+    case K_SEQ:
+      o = ll_next(&f->form);
+      env = f->env;
+      if (!f->form)
+        ll_pop(c); // the last body form is in tail position
+      eval = true;
+      break;
+    case K_DEFINE: {
+      Frame def = ll_pop(c);
+      ll_define(c, def.form, v);
+      v = def.form;
+      break;
+    }
+    }
+  }
+}
+
+/*
+ * Recovers from an allocation failure that unwound an evaluation of `c` past everything above `base`: the frames,
+ * pins and roots of the abandoned C frames are dropped and the failure is reported.
+ */
+static void ll_recover(Context *c, size_t base, size_t pinned, size_t nroots) {
+  while (c->depth > base)
+    ll_pop(c);
+  c->pinned = pinned;
+  gc_root_reset(ll_heap, nroots); // GC_ROOT scopes left by longjmp
+  ll_report(c->form, "out of memory", "");
+}
+
+/* Runs `ll_eval_steps`, the outermost evaluation of a thread catches allocation failures and returns NULL. */
+static Object *ll_eval_loop(Context *c, size_t base, Object *o, Object *env, Object *v, bool eval, size_t fuel) {
+  if (ll_failure)
+    return ll_eval_steps(c, base, o, env, v, eval, fuel);
+  jmp_buf failure;
+  size_t pinned = c->pinned, nroots = gc_root_mark(ll_heap);
+  Object *r = NULL;
+  ll_failure = &failure;
+  if (!setjmp(failure))
+    r = ll_eval_steps(c, base, o, env, v, eval, fuel);
+  else
+    ll_recover(c, base, pinned, nroots);
+  ll_failure = NULL;
+  return r;
+}
+
+static Object *ll_eval_in(Context *c, Object *o, Object *env) {
+  return ll_eval_loop(c, c->depth, o, env, NULL, true, SIZE_MAX);
+}
+
+Object *ll_eval(Context *c, Object *o) { return ll_eval_in(c, o, NULL); }
+
+bool ll_suspended(Object *o) { return ll_type(o) == D_Continuation; }
+
+/* Evaluates `o` for at most `fuel` steps, the result is a continuation if `ll_suspended` holds for it. */
+Object *ll_eval_start(Context *c, Object *o, size_t fuel) {
+  return ll_eval_loop(c, c->depth, o, NULL, NULL, true, fuel);
+}
+
+/* Continues a suspended evaluation for at most `fuel` steps, any context may resume it. */
+Object *ll_resume(Context *c, Object *k, size_t fuel) {
+  assert(ll_suspended(k));
+  Continuation *s = (Continuation *)k->cdr.cd;
+  assert(!s->resumed);
+  s->resumed = true;
+  size_t base = c->depth;
+  for (size_t i = 0; i < s->depth; ++i) {
+    ll_push(c, s->frames[i].kind, NULL, NULL);
+    c->stack[c->depth - 1] = s->frames[i];
+  }
+  return ll_eval_loop(c, base, s->o, s->env, s->v, s->eval, fuel);
+}
+
+/* Calls a function value, symbols are resolved to their global definition first. */
+Object *ll_apply(Context *c, Object *fn, Object *args) {
+  if (ll_type(fn) == D_Symbol)
+    fn = ll_defined_symbol(c, ll_to_symbol(fn));
+  if (ll_type(fn) == D_Closure) {
+    Object *env, *v = NULL;
+    for (Object *body = ll_closure_enter(c, fn, args, &env); body;)
+      v = ll_eval_in(c, ll_next(&body), env);
+    return v;
+  }
+  assert(fn && ll_type(fn) == D_CFunc);
+  c->pinned++;
+  Object *r = ll_to_cfunc(fn)(c, args);
+  c->pinned--;
+  return r;
+}
+
+/*
+ * Optimization. `ll_optimize` rewrites a form read by `ll_read` into one that evaluates to the same value with less
+ * work: global symbols bound to builtins are replaced by their CFunc, which evaluates to itself, calls of the
+ * arithmetic and comparison builtins with only numeric arguments by their result and ifs with a constant condition
+ * by the branch taken. Names bound by an enclosing lambda or defined anywhere in the form are left alone, as are the
+ * parts of special forms that are not evaluated. Unchanged subforms are shared, rewritten lists keep their location.
+ *
+ * Results are cached per context in a weak table keyed by the source form, so optimizing a form again is a lookup as
+ * long as the form is alive. Resolved builtins are bound early: closures created from an optimized form keep calling
+ * the builtin they were created with, while redefining a builtin invalidates the cache through `ll_globals_version`.
+ */
+typedef struct LLOptimizer {
+  Context *c;
+  Object *bound; // symbols that must not be resolved
+} LLOptimizer;
+
+static bool ll_optimize_bound(Object *bound, Object *sym) {
+  for (Object *b = bound; b; b = b->cdr.ob)
+    if (strcmp(ll_to_symbol(b->car.ob), ll_to_symbol(sym)) == 0)
+      return true;
+  return false;
+}
+
+/* Collects the names defined by `o` into `k->bound`, defines anywhere in a form run before its other parts may. */
+static void ll_optimize_defines(LLOptimizer *k, Object *o) {
+  if (ll_type(o) != D_List)
+    return;
+  if (ll_special(o, "define") && ll_cdr(o) && ll_type(ll_car(ll_cdr(o))) == D_Symbol)
+    k->bound = ll_cons(k->c, ll_car(ll_cdr(o)), k->bound);
+  for (Object *a = o; a; a = ll_cdr(a))
+    ll_optimize_defines(k, ll_car(a));
+}
+
+/* Builtins without side effects that are total on numbers. */
+static bool ll_foldable(CFunc fn) {
+  static const CFunc pure[] = {ll_eval_add, ll_eval_sub, ll_eval_mul, ll_eval_div, ll_eval_lt,
+                               ll_eval_eq,  ll_eval_gt,  ll_eval_le,  ll_eval_ge};
+  for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); ++i)
+    if (pure[i] == fn)
+      return true;
+  return false;
+}
+
+static Object *ll_optimize_form(LLOptimizer *k, Object *o);
+
+/* Optimizes the elements of list `o` after the first `skip`, `o` is only copied as far as something changed. */
+static Object *ll_optimize_list(LLOptimizer *k, Object *o, size_t skip) {
+  if (!o)
+    return NULL;
+  Object *car = skip ? ll_car(o) : ll_optimize_form(k, ll_car(o));
+  Object *cdr = ll_optimize_list(k, ll_cdr(o), skip ? skip - 1 : 0);
+  if (car == ll_car(o) && cdr == ll_cdr(o))
+    return o;
+  Location l;
+  if (!ll_location(o, &l))
+    return ll_cons(k->c, car, cdr);
+  Object *r = ll_malloc_ext(k->c, D_List, ll_location_forget);
+  r->car.ob = car;
+  r->cdr.ob = cdr;
+  ll_location_set(r, l);
+  return r;
+}
+
+static Object *ll_optimize_form(LLOptimizer *k, Object *o) {
+  if (ll_type(o) == D_Symbol) {
+    Object *p = ll_optimize_bound(k->bound, o) ? NULL : ll_defined_binding(k->c, ll_to_symbol(o));
+    return p && ll_type(ll_cdr(p)) == D_CFunc ? ll_cdr(p) : o;
+  }
+  if (ll_type(o) != D_List)
+    return o;
+  if (ll_special(o, "lambda")) {
+    Object *outer = k->bound, *params = ll_cdr(o) ? ll_car(ll_cdr(o)) : NULL;
+    while (ll_type(params) == D_List)
+      k->bound = ll_cons(k->c, ll_next(&params), k->bound);
+    Object *r = ll_optimize_list(k, o, 2);
+    k->bound = outer;
+    return r;
+  }
+  if (ll_special(o, "define"))
+    return ll_optimize_list(k, o, 2);
+  if (ll_special(o, "if")) {
+    Object *r = ll_optimize_list(k, o, 1), *a = ll_cdr(r);
+    if (!a || ll_type(ll_car(a)) == D_List || ll_type(ll_car(a)) == D_Symbol)
+      return r;
+    Object *branches = ll_cdr(a), *cond = ll_car(a);
+    if (cond == NULL || cond == LL_FALSE)
+      branches = branches ? ll_cdr(branches) : NULL;
+    return branches ? ll_car(branches) : NULL;
+  }
+  Object *r = ll_optimize_list(k, o, 0), *fn = ll_car(r);
+  if (ll_type(fn) != D_CFunc || !ll_foldable(ll_to_cfunc(fn)))
+    return r;
+  for (Object *a = ll_cdr(r); a; a = ll_cdr(a))
+    if (ll_type(ll_car(a)) != D_Int && ll_type(ll_car(a)) != D_Float)
+      return r;
+  return ll_to_cfunc(fn)(k->c, ll_cdr(r));
+}
+
+/* Returns an optimized equivalent of form `o`, see above. */
+Object *ll_optimize(Context *c, Object *o) {
+  LLOptimizer k = {c, NULL};
+  if (ll_type(o) != D_List)
+    return ll_optimize_form(&k, o);
+  if (!c->optimized)
+    c->optimized = ll_table(c);
+  Object *hit = ll_table_get(c->optimized, o, NULL);
+  if (hit && ll_to_int(ll_car(hit)) == (long long)ll_globals_version)
+    return ll_cdr(hit);
+  ll_optimize_defines(&k, o);
+  Object *r = ll_optimize_form(&k, o);
+  ll_table_set(c->optimized, o, ll_cons(c, ll_int(c, (long long)ll_globals_version), r));
+  return r;
+}
+
+void test_context_initialization() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+  assert(c.defined_symbols);
+
+  Object *add = ll_defined_symbol(&c, "+");
+  assert(add && ll_type(add) == D_CFunc);
+  assert(!ll_defined_symbol(&c, "not_defined"));
+
+  ll_free_context(&c);
+  assert(!c.defined_symbols);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_evaluation() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  Object *code = ll_read(&c, "(+ 1 3)", NULL);
+  assert(code);
+
+  Object *r = ll_eval(&c, code);
+  assert(ll_to_int(r) == 4);
+
+  r = ll_eval(&c, ll_read(&c, "(+ (+ 1 2) (+ 3 (+ 4 5)))", NULL));
+  assert(ll_to_int(r) == 15);
+
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(+ 1 2 3 4 5)", NULL))) == 15);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(+)", NULL))) == 0);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(*)", NULL))) == 1);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(- 10 1 2)", NULL))) == 7);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(- 5)", NULL))) == -5);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(* 2 3 7)", NULL))) == 42);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(/ 12 3 2)", NULL))) == 2);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(/ 7 2)", NULL))) == 3.5);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(/ 4)", NULL))) == 0.25);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(+ 1 2.5 3)", NULL))) == 6.5);
+  r = ll_eval(&c, ll_read(&c, "(+ 9223372036854775807 1)", NULL));
+  assert(ll_type(r) == D_Float && ll_to_float(r) == 9223372036854775808.0);
+  r = ll_eval(&c, ll_read(&c, "(* 4611686018427387904 -2)", NULL));
+  assert(ll_type(r) == D_Int && ll_to_int(r) == LLONG_MIN);
+  assert(ll_type(ll_eval(&c, ll_read(&c, "(- -9223372036854775807 2)", NULL))) == D_Float);
+  assert(ll_to_bool(ll_eval(&c, ll_read(&c, "(< 1 2 2.5 3)", NULL))));
+  assert(!ll_to_bool(ll_eval(&c, ll_read(&c, "(< 1 3 2)", NULL))));
+  assert(ll_to_bool(ll_eval(&c, ll_read(&c, "(<= 1 1 2)", NULL))));
+  assert(!ll_to_bool(ll_eval(&c, ll_read(&c, "(> 2 2)", NULL))));
+  assert(ll_to_bool(ll_eval(&c, ll_read(&c, "(>= 3 2.0 2)", NULL))));
+  assert(ll_to_bool(ll_eval(&c, ll_read(&c, "(= 2 2.0 2)", NULL))));
+  assert(!ll_to_bool(ll_eval(&c, ll_read(&c, "(= 9007199254740993 9007199254740992)", NULL))));
+  ll_eval(&c, ll_read(&c, "(define nan (/ 0 0))", NULL));
+  const char *unordered[] = {"(= nan 1)",  "(< nan 1)",   "(> nan 1)",   "(<= nan 1)",
+                             "(>= 1 nan)", "(= nan nan)", "(<= 1 2 nan)"};
+  for (size_t i = 0; i < sizeof(unordered) / sizeof(*unordered); ++i)
+    assert(!ll_to_bool(ll_eval(&c, ll_read(&c, unordered[i], NULL))));
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(len [1 2 3])", NULL))) == 3);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(nth [5 6 7] 2)", NULL))) == 7);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(fold + 0 [1 2 3 4])", NULL))) == 10);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(fold + 1 (vec 1 (+ 1 1) 3))", NULL))) == 7);
+  r = ll_eval(&c, ll_read(&c, "(map len [[1] [] [1 2 3]])", NULL));
+  assert(ll_type(r) == D_Vector && ll_to_vector(r)->size == 3 && ll_to_int(ll_to_vector(r)->items[2]) == 3);
+
+  ll_free_context(&c);
+  assert(!c.defined_symbols);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_tail_calls() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "((lambda (x y) (- x y)) 7 2)", NULL))) == 5);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(if (< 1 2) 1 2)", NULL))) == 1);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(if (> 1 2) 1 2)", NULL))) == 2);
+  assert(!ll_eval(&c, ll_read(&c, "(if (> 1 2) 1)", NULL)));
+
+  ll_eval(&c, ll_read(&c, "(define make-adder (lambda (n) (lambda (x) (+ x n))))", NULL));
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "((make-adder 3) 4)", NULL))) == 7);
+  ll_eval(&c, ll_read(&c, "(define add3 (make-adder 3))", NULL));
+  Object *r = ll_eval(&c, ll_read(&c, "(map add3 [1 2 3])", NULL));
+  assert(ll_to_int(ll_to_vector(r)->items[0]) == 4 && ll_to_int(ll_to_vector(r)->items[2]) == 6);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(fold (lambda (a x) (+ a (* x x))) 0 [1 2 3])", NULL))) == 14);
+  ll_eval(&c, ll_read(&c, "(define n 10)", NULL));
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "((lambda (n) n) 1)", NULL))) == 1);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "n", NULL))) == 10);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "((lambda (x) 1 2 x) 3)", NULL))) == 3);
+
+  // a loop written as tail recursion runs in constant stack space
+  ll_eval(&c, ll_read(&c, "(define loop (lambda (i acc) (if (= i 0) acc (loop (- i 1) (+ acc 2)))))", NULL));
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(loop 20000 0)", NULL))) == 40000);
+  assert(c.depth == 0 && c.stack_cap <= 64);
+  ll_eval(&c, ll_read(&c, "(define even (lambda (i) (if (= i 0) true (odd (- i 1)))))", NULL));
+  ll_eval(&c, ll_read(&c, "(define odd (lambda (i) (if (= i 0) false (even (- i 1)))))", NULL));
+  assert(ll_to_bool(ll_eval(&c, ll_read(&c, "(even 20001)", NULL))) == false);
+  assert(c.stack_cap <= 64);
+
+  // deep non tail recursion grows the heap allocated stack, not the C stack
+  ll_eval(&c, ll_read(&c, "(define count (lambda (i) (if (= i 0) 0 (+ 1 (count (- i 1))))))", NULL));
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(count 500)", NULL))) == 500);
+  assert(c.depth == 0);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_call_caches() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  ll_eval(&c, ll_read(&c, "(define f (lambda (x) (+ x 1)))", NULL));
+  Object *site = ll_read(&c, "(f 1)", NULL);
+  assert(ll_call_cache(site) && !ll_call_cache(site)->binding);
+  assert(ll_to_int(ll_eval(&c, site)) == 2);
+  assert(ll_call_cache(site)->binding == ll_defined_binding(&c, "f"));
+  assert(ll_to_int(ll_eval(&c, site)) == 2);
+
+  // redefinition updates the cached binding in place
+  ll_eval(&c, ll_read(&c, "(define f (lambda (x) (* x 10)))", NULL));
+  assert(ll_to_int(ll_eval(&c, site)) == 10);
+
+  // locals shadow cached globals
+  Object *g = ll_read(&c, "(define g (lambda (f) (f 3)))", NULL);
+  ll_eval(&c, g);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(g (lambda (y) (- y)))", NULL))) == -3);
+
+  // a cache does not outlive the globals of its context
+  ll_free_context(&c);
+  ll_init_context(&c);
+  ll_eval(&c, ll_read(&c, "(define f (lambda (x) (- x 1)))", NULL));
+  assert(ll_to_int(ll_eval(&c, site)) == 0);
+  assert(ll_call_cache(site)->binding == ll_defined_binding(&c, "f"));
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_optimization() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  // constant subexpressions fold into their value
+  assert(ll_to_int(ll_optimize(&c, ll_read(&c, "(+ (* 2 3) (- 10 4))", NULL))) == 12);
+  assert(ll_to_float(ll_optimize(&c, ll_read(&c, "(/ 1 4)", NULL))) == 0.25);
+  assert(ll_to_int(ll_optimize(&c, ll_read(&c, "(if (< 1 2) 10 20)", NULL))) == 10);
+
+  // builtins are resolved, the rewritten form keeps its location and is cached
+  Object *src = ll_read(&c, "\n  (define f (lambda (x) (+ x (* 2 3))))", NULL);
+  Object *o = ll_optimize(&c, src);
+  assert(o != src && ll_optimize(&c, src) == o);
+  Location l;
+  assert(ll_location(o, &l) && l_line(l) == 2 && l_column(l) == 3);
+  Object *body = ll_car(ll_cdr(ll_cdr(ll_car(ll_cdr(ll_cdr(o))))));
+  assert(ll_type(ll_car(body)) == D_CFunc && ll_to_int(ll_car(ll_cdr(ll_cdr(body)))) == 6);
+  ll_eval(&c, o);
+  assert(ll_to_int(ll_eval(&c, ll_optimize(&c, ll_read(&c, "(f 1)", NULL)))) == 7);
+
+  // unchanged forms are shared, undefined symbols and locals stay symbols
+  src = ll_read(&c, "(g \"text\" [1 2])", NULL);
+  assert(ll_optimize(&c, src) == src);
+  o = ll_optimize(&c, ll_read(&c, "(lambda (+) (+ 1 2))", NULL));
+  body = ll_car(ll_cdr(ll_cdr(o)));
+  assert(ll_type(ll_car(body)) == D_Symbol);
+  assert(ll_to_int(ll_eval(&c, ll_optimize(&c, ll_read(&c, "((lambda (+) (+ 1 2)) -)", NULL)))) == -1);
+
+  // a builtin defined by the form itself is not resolved, and redefining one invalidates the cache
+  src = ll_read(&c, "(* 2 3)", NULL);
+  assert(ll_to_int(ll_optimize(&c, src)) == 6);
+  assert(ll_to_int(ll_eval(&c, ll_optimize(&c, ll_read(&c, "((lambda (y) (define * +) (* 2 3)) 0)", NULL)))) == 5);
+  assert(ll_to_int(ll_optimize(&c, src)) == 5);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_resumable() {
+  printf("%s...", __FUNCTION__);
+
+  Context a, b;
+  ll_init_context(&a);
+  ll_init_context(&b);
+
+  const char *loop = "(define loop (lambda (i acc) (if (= i 0) acc (loop (- i 1) (+ acc i)))))";
+  ll_eval(&a, ll_read(&a, loop, NULL));
+  ll_eval(&b, ll_read(&b, loop, NULL));
+
+  Object *ra = ll_eval_start(&a, ll_read(&a, "(loop 1000 0)", NULL), 0);
+  Object *rb = ll_eval_start(&b, ll_read(&b, "(+ 1 (loop 500 0))", NULL), 50);
+  assert(ll_suspended(ra) && ll_suspended(rb));
+  assert(a.depth == 0 && b.depth == 0);
+  int slices = 0;
+  while (ll_suspended(ra) || ll_suspended(rb)) {
+    if (ll_suspended(ra))
+      ra = ll_resume(&a, ra, 100);
+    if (ll_suspended(rb))
+      rb = ll_resume(&b, rb, 100);
+    ++slices;
+  }
+  assert(ll_to_int(ra) == 500500 && ll_to_int(rb) == 125251);
+  assert(slices > 10 && a.depth == 0 && b.depth == 0);
+
+  // a continuation can be resumed by another context sharing its globals
+  Object *k = ll_eval_start(&a, ll_read(&a, "(+ (loop 10 0) (loop 20 0))", NULL), 5);
+  assert(ll_suspended(k));
+  Object *r = k;
+  while (ll_suspended(r))
+    r = ll_resume(&b, r, 3);
+  assert(ll_to_int(r) == 265);
+
+  assert(ll_to_int(ll_eval_start(&a, ll_read(&a, "(+ 1 2)", NULL), 10)) == 3);
+
+  ll_free_context(&a);
+  ll_free_context(&b);
+
+  printf("%s\n", "ok");
+}
+
+void test_context_parallel() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+  ll_set_workers(4);
+
+  ll_eval(&c, ll_read(&c, "(define sq (lambda (x) (* x x)))", NULL));
+  Object *r = ll_eval(&c, ll_read(&c, "(pmap sq [1 2 3 4 5 6 7 8 9 10])", NULL));
+  assert(ll_type(r) == D_Vector && ll_to_vector(r)->size == 10);
+  for (size_t i = 0; i < 10; ++i)
+    assert(ll_to_int(ll_to_vector(r)->items[i]) == (long long)((i + 1) * (i + 1)));
+  r = ll_eval(&c, ll_read(&c, "(pmap (lambda (x) (+ x 0.5)) (vec 1 2 3))", NULL));
+  assert(ll_to_float(ll_to_vector(r)->items[2]) == 3.5);
+  assert(ll_to_vector(ll_eval(&c, ll_read(&c, "(pmap sq [])", NULL)))->size == 0);
+  Object *list = ll_list(&c, 3, (Object *[]){ll_int(&c, 4), ll_int(&c, 5), ll_int(&c, 6)});
+  r = ll_eval_pmap(&c, ll_list(&c, 2, (Object *[]){ll_symbol(&c, "sq"), list}));
+  assert(ll_type(r) == D_List && ll_to_int(ll_next(&r)) == 16 && ll_to_int(ll_next(&r)) == 25);
+  assert(ll_to_int(ll_next(&r)) == 36 && !r);
+  r = ll_eval(&c, ll_read(&c, "((lambda (k) (pmap (lambda (x) (* x k)) [1 2 3])) 10)", NULL));
+  assert(ll_to_int(ll_to_vector(r)->items[0]) == 10 && ll_to_int(ll_to_vector(r)->items[2]) == 30);
+
+  // results allocated by the workers are copied into the caller's heap
+  const char *worker = "(pmap (lambda (x) (vec x \"a long worker string\" (f64-array 1.5 x))) [1 2 3 4 5])";
+  r = ll_eval(&c, ll_read(&c, worker, NULL));
+  gc_run(&gc);
+  Vector *v = ll_to_vector(ll_to_vector(r)->items[4]);
+  assert(ll_to_int(v->items[0]) == 5 && strcmp(ll_to_string(v->items[1]), "a long worker string") == 0);
+  assert(ll_f64s(v->items[2])[0] == 1.5 && ll_f64s(v->items[2])[1] == 5.0);
+
+  // shared structure stays shared and cycles are copied as cycles
+  r = ll_eval(&c, ll_read(&c, "(pmap (lambda (x) ((lambda (v) (vec v v)) (vec x))) [1 2 3 4])", NULL));
+  v = ll_to_vector(ll_to_vector(r)->items[3]);
+  assert(v->items[0] == v->items[1] && ll_to_int(ll_to_vector(v->items[0])->items[0]) == 4);
+  r = ll_eval(&c, ll_read(&c, "(pmap (lambda (x) ((lambda (t) (table-set t x t) t) (table))) [1 2])", NULL));
+  Object *t = ll_to_vector(r)->items[1];
+  assert(gc_owns(ll_heap, t) && ll_table_get(t, ll_int(&c, 2), NULL) == t);
+
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(preduce + 0 [1 2 3 4 5 6 7 8 9 10])", NULL))) == 55);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(preduce + 100 [1 2])", NULL))) == 103);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(preduce + 7 [])", NULL))) == 7);
+  r = ll_eval(&c, ll_read(&c, "(preduce (lambda (a b) (+ a b)) 0 (pmap sq (vec 1 2 3 4 5 6 7 8 9)))", NULL));
+  assert(ll_to_int(r) == 285);
+
+  // a worker that runs out of memory fails the call once the pool is idle again
+  ll_eval(&c, ll_read(&c, "(define grow (lambda (i acc) (if (= i 0) acc (grow (- i 1) (vec i acc)))))", NULL));
+  Object *src = ll_read(&c, "(pmap (lambda (n) (grow n 0)) [1 2 100000 3])", NULL);
+  size_t nroots = gc_root_mark(ll_heap);
+  for (int workers = 1; workers <= 2; ++workers) {
+    ll_set_workers(workers);
+    gc_run(ll_heap);
+    gc_heap_limit(ll_heap, ll_heap->heap_size + 4096);
+    assert(!ll_eval(&c, src) && ll_heap == &gc && c.depth == 0 && c.pinned == 0 && gc_root_mark(ll_heap) == nroots);
+    assert(ll_pool.running == 0 && !ll_pool.jobs);
+    gc_heap_limit(ll_heap, 0);
+    r = ll_eval(&c, ll_read(&c, "(pmap (lambda (n) (nth (grow n 0) 0)) [1 2 3])", NULL));
+    assert(ll_to_int(ll_to_vector(r)->items[2]) == 1);
+  }
+
+  ll_set_workers(0);
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_string_builders() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  Object *b = ll_builder(&c);
+  assert(ll_to_builder(b)->size == 0 && strcmp(ll_to_string(ll_builder_string(&c, b)), "") == 0);
+  for (int i = 0; i < 10000; ++i)
+    ll_builder_append(b, i % 2 ? "ab" : "c", i % 2 ? 2 : 1);
+  assert(ll_to_builder(b)->size == 15000 && ll_to_builder(b)->cap < 2 * 15001);
+  Object *s = ll_builder_string(&c, b);
+  assert(strlen(ll_to_string(s)) == 15000 && strncmp(ll_to_string(s), "cabcab", 6) == 0);
+  assert(ll_builder_string(&c, b) == s);
+  ll_builder_append(b, "!", 1);
+  assert(ll_builder_string(&c, b) != s && ll_to_string(ll_builder_string(&c, b))[15000] == '!');
+
+  ll_eval(&c, ll_read(&c, "(define out (builder \"hello\"))", NULL));
+  ll_eval(&c, ll_read(&c, "(append out \", \" \"long \" \"world\")", NULL));
+  Object *r = ll_eval(&c, ll_read(&c, "(str out)", NULL));
+  assert(strcmp(ll_to_string(r), "hello, long world") == 0);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(len out)", NULL))) == 17);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(len \"abc\")", NULL))) == 3);
+  r = ll_eval(&c, ll_read(&c, "(substring out 7 11)", NULL));
+  assert(strcmp(ll_to_string(r), "long") == 0);
+  r = ll_eval(&c, ll_read(&c, "(substring \"a long string here\" 7)", NULL));
+  assert(strcmp(ll_to_string(r), "string here") == 0);
+  r = ll_eval(&c, ll_read(&c, "(join \", \" (vec \"a\" \"bc\" \"def\" out))", NULL));
+  assert(strcmp(ll_to_string(r), "a, bc, def, hello, long world") == 0);
+  r = ll_eval(&c, ll_read(&c, "(join \"-\" [])", NULL));
+  assert(strcmp(ll_to_string(r), "") == 0);
+  r = ll_eval(&c, ll_read(&c, "(join \"+\" [\"a\" \"b\"])", NULL));
+  assert(ll_type_internal(r) == D_String && strcmp(ll_to_string(r), "a+b") == 0);
+  r = ll_eval(&c, ll_read(&c, "(str (fold append (builder) [\"x\" \"y\" \"z\"]))", NULL));
+  assert(strcmp(ll_to_string(r), "xyz") == 0);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+/* Fills `t` with entries whose keys are only reachable from the table, the value of each refers back to its key. */
+static __attribute__((noinline)) Object *test_weak_fill(Context *c, Object *t, int n) {
+  for (int i = 0; i < n; ++i) {
+    Object *key = ll_vector(c, 1);
+    ll_to_vector(key)->items[0] = ll_int(c, i);
+    ll_table_set(t, key, ll_cons(c, key, NULL));
+  }
+  return ll_weak(c, ll_vector(c, 0));
+}
+
+/* Overwrites dead stack slots, so the conservative scan does not find stale pointers. */
+static __attribute__((noinline)) void test_clear_stack() {
+  volatile char buf[16384];
+  for (size_t i = 0; i < sizeof(buf); ++i) // a memset of a dead buffer may be optimized away
+    buf[i] = 0;
+}
+
+void test_weak_tables() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  Object *t = ll_table(&c), *k1 = ll_vector(&c, 0), *k2 = ll_vector(&c, 0);
+  assert(ll_table_count(t) == 0 && ll_table_get(t, k1, LL_FALSE) == LL_FALSE);
+  ll_table_set(t, k1, ll_int(&c, 1));
+  ll_table_set(t, k2, ll_int(&c, 2));
+  ll_table_set(t, ll_int(&c, 7), k1);
+  for (int i = 0; i < 100; ++i)
+    ll_table_set(t, ll_int(&c, 100 + i), ll_int(&c, i));
+  assert(ll_table_count(t) == 103 && ll_to_int(ll_table_get(t, k2, NULL)) == 2);
+  assert(ll_table_get(t, ll_int(&c, 7), NULL) == k1 && ll_to_int(ll_table_get(t, ll_int(&c, 199), NULL)) == 99);
+  ll_table_delete(t, k1);
+  assert(ll_table_count(t) == 102 && !ll_table_get(t, k1, NULL) && ll_to_int(ll_table_get(t, k2, NULL)) == 2);
+  ll_table_set(t, k1, ll_int(&c, 3));
+  assert(ll_to_int(ll_table_get(t, k1, NULL)) == 3);
+
+  Object *w = ll_weak(&c, k1);
+  gc_pause(ll_heap); // keeps dead entries until the collection below
+  Object *dead = test_weak_fill(&c, t, 50);
+  gc_resume(ll_heap);
+  assert(ll_table_count(t) == 153);
+  test_clear_stack();
+  gc_run(ll_heap);
+  assert(ll_table_count(t) == 103 && ll_weak_get(w) == k1 && !ll_weak_get(dead));
+  assert(ll_to_int(ll_table_get(t, k1, NULL)) == 3 && ll_to_int(ll_table_get(t, k2, NULL)) == 2);
+
+  ll_eval(&c, ll_read(&c, "(define memo (table))", NULL));
+  ll_eval(&c, ll_read(&c, "(table-set memo 5 \"five\")", NULL));
+  Object *r = ll_eval(&c, ll_read(&c, "(table-get memo 5)", NULL));
+  assert(strcmp(ll_to_string(r), "five") == 0);
+  assert(ll_eval(&c, ll_read(&c, "(table-get memo 6 false)", NULL)) == LL_FALSE);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(table-count (table-delete memo 5))", NULL))) == 0);
+  r = ll_eval(&c, ll_read(&c, "(weak-get (weak \"x\"))", NULL));
+  assert(!r || strcmp(ll_to_string(r), "x") == 0);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_heap_profile() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  FILE *report = tmpfile(), *folded = tmpfile();
+  assert(report && folded && !gc_profile_write(ll_heap, folded, false));
+  ll_profile_start(&c, 1, report); // sample every allocation, the sites below are small
+  const char *src = "(define xs\n  (map (lambda (x) (vec x x x x)) [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16]))";
+  ll_eval(&c, ll_read(&c, src, NULL));
+  gc_run(ll_heap);
+  assert(gc_profile_write(ll_heap, folded, false));
+  void *blocks[200]; // sampled blocks that move and die, their sites follow them
+  for (int i = 0; i < 200; ++i)
+    assert((blocks[i] = gc_malloc(ll_heap, 16)));
+  for (int i = 0; i < 200; i += 2)
+    assert((blocks[i] = gc_realloc(ll_heap, blocks[i], 4096)));
+  for (int i = 0; i < 200; ++i)
+    gc_free(ll_heap, blocks[i]);
+  gc_profile_stop(ll_heap);
+
+  char text[16384];
+  size_t n = (rewind(report), fread(text, 1, sizeof(text) - 1, report));
+  text[n] = '\0';
+  assert(strncmp(text, "gc profile: ", 12) == 0);
+  n = (rewind(folded), fread(text, 1, sizeof(text) - 1, folded));
+  text[n] = '\0';
+  assert(strstr(text, "vec@2:20;") && strstr(text, "map@2:3;"));
+  for (char *line = text; *line; line = strchr(line, '\n') + 1)
+    assert(strchr(line, '\n') && strtoull(strrchr(line, ' ') + 1, NULL, 10) > 0);
+  fclose(report);
+  fclose(folded);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_large_objects() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  size_t big = 2 * GC_LARGE_SIZE;
+  char *p = (char *)gc_calloc(ll_heap, big, 1);
+  assert(p && gc_owns(ll_heap, p) && p[0] == 0 && p[big - 1] == 0);
+  memset(p, 'x', big);
+  p = (char *)gc_realloc(ll_heap, p, 4 * big);
+  assert(p && gc_owns(ll_heap, p) && p[0] == 'x' && p[big - 1] == 'x');
+  p = (char *)gc_realloc(ll_heap, p, 100);
+  assert(p && gc_owns(ll_heap, p) && p[0] == 'x' && p[99] == 'x');
+  p = (char *)gc_realloc(ll_heap, p, big);
+  assert(p && p[99] == 'x');
+  gc_free(ll_heap, p);
+
+  /* a large vector keeps its items alive */
+  Object *v = ll_vector(&c, GC_LARGE_SIZE / sizeof(Object *));
+  for (size_t i = 0; i < ll_to_vector(v)->size; i += 1024)
+    ll_to_vector(v)->items[i] = ll_string(&c, "a string longer than eight characters");
+  gc_run(ll_heap);
+  for (size_t i = 0; i < ll_to_vector(v)->size; i += 1024)
+    assert(strcmp(ll_to_string(ll_to_vector(v)->items[i]), "a string longer than eight characters") == 0);
+
+  Object *b = ll_builder(&c);
+  for (int i = 0; i < 1024; ++i)
+    ll_builder_append(b, "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef", 64);
+  assert(ll_to_builder(b)->size == 65536);
+  for (int i = 0; i < 8; ++i)
+    ll_builder_append(b, ll_to_builder(b)->text, ll_to_builder(b)->size);
+  assert(ll_to_builder(b)->size == 65536 << 8 && memcmp(ll_to_builder(b)->text + (65536 << 7), "0123", 4) == 0);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+static __attribute__((noinline)) void test_garbage(size_t size) { memset(gc_malloc(ll_heap, size), 1, size); }
+
+void test_heap_limit() {
+  printf("%s...", __FUNCTION__);
+
+  size_t mb = 1024 * 1024;
+  test_garbage(mb);
+  test_clear_stack();
+  size_t used = ll_heap->heap_size, freed = gc_run(ll_heap);
+  assert(freed >= mb && ll_heap->heap_size == used - freed);
+
+  gc_heap_limit(ll_heap, ll_heap->heap_size + mb);
+  errno = 0;
+  assert(!gc_malloc(ll_heap, 2 * mb) && errno == ENOMEM);
+  assert(!gc_realloc(ll_heap, gc_malloc(ll_heap, 16), 2 * mb) && errno == ENOMEM);
+
+  // the second request only fits once the emergency collection has freed the first
+  test_garbage(3 * mb / 4);
+  test_clear_stack();
+  assert(ll_heap->heap_size + mb / 2 > ll_heap->heap_limit);
+  char *p = (char *)gc_malloc(ll_heap, mb / 2);
+  assert(p && ll_heap->heap_size <= ll_heap->heap_limit);
+  gc_heap_limit(ll_heap, 0);
+  assert(gc_malloc(ll_heap, 2 * mb));
+  gc_scavenge(ll_heap);
+  assert(ll_heap->unreturned == 0);
+
+  // evaluations that run out of memory fail and leave their context usable
+  Context c;
+  ll_init_context(&c);
+  ll_eval(&c, ll_read(&c, "(define grow (lambda (i acc) (if (= i 0) acc (grow (- i 1) (vec i acc)))))", NULL));
+  Object *src = ll_read(&c, "(grow 100000 0)", NULL);
+  size_t nroots = gc_root_mark(ll_heap);
+  gc_run(ll_heap);
+  gc_heap_limit(ll_heap, ll_heap->heap_size + 4096);
+  assert(!ll_eval(&c, src) && c.depth == 0 && c.pinned == 0 && gc_root_mark(ll_heap) == nroots);
+  gc_heap_limit(ll_heap, 0);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(nth (grow 3 0) 0)", NULL))) == 1);
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+/* A backing allocator that counts the blocks and bytes it hands out. */
+typedef struct TestArena {
+  long blocks, bytes;
+} TestArena;
+
+static void *test_arena_alloc(void *ctx, size_t size) {
+  TestArena *a = (TestArena *)ctx;
+  a->blocks++;
+  a->bytes += (long)size;
+  return malloc(size);
+}
+
+static void *test_arena_zalloc(void *ctx, size_t count, size_t size) {
+  return memset(test_arena_alloc(ctx, count * size), 0, count * size);
+}
+
+static void *test_arena_realloc(void *ctx, void *ptr, size_t old_size, size_t size) {
+  TestArena *a = (TestArena *)ctx;
+  a->blocks += !ptr;
+  a->bytes += (long)size - (long)old_size;
+  return realloc(ptr, size);
+}
+
+static void test_arena_free(void *ctx, void *ptr, size_t size) {
+  TestArena *a = (TestArena *)ctx;
+  a->blocks--;
+  a->bytes -= (long)size;
+  free(ptr);
+}
+
+void test_backing_allocators() {
+  printf("%s...", __FUNCTION__);
+
+  TestArena payload = {0}, metadata = {0};
+  GCAllocator p = {test_arena_alloc, test_arena_zalloc, test_arena_realloc, test_arena_free, &payload};
+  GCAllocator m = {test_arena_alloc, test_arena_zalloc, test_arena_realloc, test_arena_free, &metadata};
+  GarbageCollector heap;
+  gc_start_alloc(&heap, &heap, &p, &m);
+  assert(payload.blocks == 0 && metadata.blocks == 2);
+
+  char *s = gc_strdup(&heap, "kept");
+  for (int i = 0; i < 100; ++i)
+    gc_calloc(&heap, 4, 1000);
+  s = (char *)gc_realloc(&heap, s, 2 * GC_LARGE_SIZE);
+  assert(payload.blocks == 101 && payload.bytes == 400000 + 2 * GC_LARGE_SIZE);
+  assert(metadata.blocks > 101 && strcmp(s, "kept") == 0);
+
+  // the heap profile takes its tables from the metadata allocator, too
+  long blocks = metadata.blocks;
+  gc_profile_start(&heap, 1, NULL);
+  void *sampled = gc_malloc(&heap, 64);
+  assert(sampled && metadata.blocks == blocks + 4); // the profile, the allocation, its site and the sample table
+  gc_profile_stop(&heap);
+  assert(metadata.blocks == blocks + 1);
+  gc_stop(&heap);
+  assert(payload.blocks == 0 && payload.bytes == 0 && metadata.blocks == 0 && metadata.bytes == 0);
+
+  printf("%s\n", "ok");
+}
+
+void test_precise_roots() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+  gc_scan_stack(ll_heap, false);
+
+  Object *kept = ll_string(&c, "a string that is registered");
+  GC_ROOT(ll_heap, kept);
+  Object *w = ll_weak(&c, ll_string(&c, "a string that is only on the stack"));
+  GC_ROOT(ll_heap, w);
+  Object *s = ll_weak_get(w);
+  gc_run(ll_heap);
+  assert(strcmp(ll_to_string(kept), "a string that is registered") == 0 && !ll_weak_get(w) && s);
+
+  // resetting the root table drops the slots registered since the mark, as a longjmp past them does
+  Object *t = ll_string(&c, "a string that is registered for a while");
+  Object *wt = ll_weak(&c, t);
+  GC_ROOT(ll_heap, wt);
+  size_t mark = gc_root_mark(ll_heap);
+  gc_add_root(ll_heap, (void **)&t);
+  gc_root_reset(ll_heap, mark);
+  gc_run(ll_heap);
+  assert(gc_root_mark(ll_heap) == mark && !ll_weak_get(wt));
+
+  const char *src = "(define count (lambda (n acc) (if (= n 0) acc (count (- n 1) (vec n acc)))))";
+  ll_eval(&c, ll_read(&c, src, NULL));
+  Object *r = ll_eval(&c, ll_read(&c, "(count 400 [])", NULL));
+  GC_ROOT(ll_heap, r);
+  size_t n = 0;
+  for (; ll_to_vector(r)->size == 2; r = ll_to_vector(r)->items[1])
+    assert(ll_to_int(ll_to_vector(r)->items[0]) == (long long)++n);
+  assert(n == 400);
+  r = ll_eval(&c, ll_read(&c, "(fold + 0 (map (lambda (x) (* x x)) (vec 1 2 3 4)))", NULL));
+  assert(ll_to_int(r) == 30);
+
+  // allocations do not collect, the safepoints of the evaluator keep the garbage under the limit
+  ll_eval(&c, ll_read(&c, "(define spin (lambda (n) (if (= n 0) n (spin (- n 1)))))", NULL));
+  Object *spin = ll_read(&c, "(spin 20000)", NULL);
+  GC_ROOT(ll_heap, spin);
+  gc_run(ll_heap);
+  gc_heap_limit(ll_heap, ll_heap->heap_size + 8 * 1024);
+  r = ll_eval(&c, spin);
+  assert(r && ll_to_int(r) == 0);
+  gc_heap_limit(ll_heap, 0);
+
+  gc_scan_stack(ll_heap, true);
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+static size_t test_released;
+
+static void test_release(void *p) {
+  test_released++;
+  free(p);
+}
+
+static __attribute__((noinline)) void test_native_garbage(Context *c, int n, size_t size) {
+  for (int i = 0; i < n; ++i)
+    ll_cdata_ext(c, malloc(size), size, test_release);
+}
+
+void test_external_memory() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  size_t mb = 1024 * 1024, base = ll_heap->external_size;
+  Object *o = ll_cdata_ext(&c, malloc(mb), mb, test_release);
+  assert(ll_heap->external_size == base + mb && ll_to_cdata(o));
+  assert(ll_type(o) == D_CData && ll_type_internal(o) == D_OwnedCData);
+  ll_cdata_resize(o, 3 * (ptrdiff_t)mb);
+  ll_cdata_resize(o, -(ptrdiff_t)mb);
+  assert(ll_heap->external_size == base + 3 * mb);
+
+  /* far fewer objects than a collection is due for by count, but enough native memory */
+  test_native_garbage(&c, 64, mb);
+  assert(test_released > 0 && ll_heap->external_size < base + 64 * mb);
+  test_clear_stack();
+  gc_run(ll_heap);
+  assert(test_released >= 56 && ll_heap->external_size <= base + 3 * mb + 8 * mb);
+  assert(ll_to_cdata(o) && ll_heap->external_size >= base + 3 * mb);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+static uint64_t test_trace_word(FILE *in) {
+  uint64_t v = 0;
+  int c, shift = 0;
+  do {
+    c = getc(in);
+    assert(c != EOF);
+    v |= (uint64_t)(c & 0x7F) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return v;
+}
+
+void test_allocation_trace() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  FILE *trace = tmpfile();
+  assert(trace && gc_trace_start(ll_heap, trace));
+  const char *src = "(define ys\n  (map (lambda (x) (vec x x x x)) [1 2 3 4 5 6 7 8]))";
+  ll_eval(&c, ll_read(&c, src, NULL));
+  for (int i = 0; i < 256; ++i)
+    test_garbage(64);
+  test_clear_stack();
+  gc_run(ll_heap);
+  assert(gc_trace_stop(ll_heap) && !ll_heap->trace);
+
+  char magic[sizeof(GC_TRACE_MAGIC) - 1];
+  rewind(trace);
+  assert(fread(magic, 1, sizeof(magic), trace) == sizeof(magic) && !memcmp(magic, GC_TRACE_MAGIC, sizeof(magic)));
+  size_t counts[GC_TRACE_EDGE + 1] = {0}, vectors = 0;
+  int op;
+  while ((op = getc(trace)) != EOF) {
+    assert(op >= GC_TRACE_ALLOC && op <= GC_TRACE_EDGE);
+    counts[op]++;
+    if (op == GC_TRACE_ALLOC) {
+      uint64_t ptr = test_trace_word(trace), size = test_trace_word(trace), kind = test_trace_word(trace);
+      assert(ptr && kind <= GC_TRACE_EPHEMERON);
+      vectors += size == sizeof(Vector) + 4 * sizeof(Object *) && kind == GC_TRACE_PLAIN;
+    } else if (op == GC_TRACE_REALLOC) {
+      test_trace_word(trace), test_trace_word(trace), test_trace_word(trace);
+    } else if (op == GC_TRACE_EDGE) {
+      uint64_t from = test_trace_word(trace), to = test_trace_word(trace);
+      assert(from && to);
+    } else if (op != GC_TRACE_COLLECT) {
+      assert(test_trace_word(trace));
+    }
+  }
+  assert(vectors >= 8 && counts[GC_TRACE_COLLECT] >= 1 && counts[GC_TRACE_DEAD] >= 200);
+  // the evaluation loop registers its machine state as roots for its duration
+  assert(counts[GC_TRACE_ADD_ROOT] >= 3 && counts[GC_TRACE_ADD_ROOT] == counts[GC_TRACE_REMOVE_ROOT]);
+  // collections record the graph they mark, ys alone holds 8 vectors each with a body of its own
+  assert(counts[GC_TRACE_REACH] >= 1 && counts[GC_TRACE_EDGE] >= 16);
+  fclose(trace);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+void test_numeric_arrays() {
+  printf("%s...", __FUNCTION__);
+
+  const ArrayKernels *sets[3] = {&ll_scalar_kernels};
+  size_t nsets = 1;
+#ifdef LL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    sets[nsets++] = &ll_sse2_kernels;
+  if (__builtin_cpu_supports("avx2"))
+    sets[nsets++] = &ll_avx2_kernels;
+#endif
+  assert(ll_kernels() == sets[nsets - 1]);
+
+  double f[19], g[19], rf[19];
+  long long i[19], j[19], ri[19];
+  for (size_t n = 0; n < 19; ++n) {
+    f[n] = (double)((n * 7) % 11) - 4.5;
+    g[n] = 0.25 * (double)n;
+    i[n] = (long long)((n * 5) % 13) - 6;
+    j[n] = n % 2 ? LLONG_MAX : 3;
+  }
+  for (size_t k = 0; k < nsets; ++k) {
+    const ArrayKernels *s = sets[k];
+    for (size_t n = 1; n <= 19; n += 2) {
+      assert(s->f64_sum(f, n) == f64_sum_scalar(f, n));
+      assert(s->f64_min(f, n) == f64_min_scalar(f, n) && s->f64_max(f, n) == f64_max_scalar(f, n));
+      assert(s->f64_dot(f, g, n) == f64_dot_scalar(f, g, n));
+      assert(s->i64_sum(j, n) == i64_sum_scalar(j, n));
+      assert(s->i64_min(i, n) == i64_min_scalar(i, n) && s->i64_max(i, n) == i64_max_scalar(i, n));
+      s->f64_add(rf, f, g, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(rf[m] == f[m] + g[m]);
+      s->f64_mul(rf, f, g, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(rf[m] == f[m] * g[m]);
+      s->f64_scale(rf, f, -2.0, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(rf[m] == f[m] * -2.0);
+      s->i64_add(ri, i, j, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(ri[m] == (long long)((unsigned long long)i[m] + (unsigned long long)j[m]));
+      assert(s->i64_dot(i, j, n) == i64_dot_scalar(i, j, n));
+      s->i64_mul(ri, i, j, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(ri[m] == (long long)((unsigned long long)i[m] * (unsigned long long)j[m]));
+      s->i64_scale(ri, j, -3, n);
+      for (size_t m = 0; m < n; ++m)
+        assert(ri[m] == (long long)((unsigned long long)j[m] * (unsigned long long)-3));
+    }
+    assert(s->f64_sum(f, 0) == 0.0 && s->i64_sum(i, 0) == 0);
+  }
+
+  Context c;
+  ll_init_context(&c);
+
+  Object *a = ll_eval(&c, ll_read(&c, "(f64-array 1 2.5 -3 4 5)", NULL));
+  assert(ll_type(a) == D_F64Array && ll_to_array(a)->size == 5 && ll_f64s(a)[2] == -3.0);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(sum (f64-array 1 2.5 -3 4 5))", NULL))) == 9.5);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(min (f64-array 1 2.5 -3 4 5))", NULL))) == -3.0);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(max (f64-array [1 2.5 -3 4 5]))", NULL))) == 5.0);
+  assert(ll_to_float(ll_eval(&c, ll_read(&c, "(dot (f64-array 1 2 3) (f64-array 4 5 6))", NULL))) == 32.0);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(sum (i64-array [1 2 3 4 5 6 7]))", NULL))) == 28);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(dot (i64-array 1 2 3) (i64-array 4 5 6))", NULL))) == 32);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(len (i64-array 9 8 7))", NULL))) == 3);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(nth (i64-array 9 8 7) 1)", NULL))) == 8);
+  a = ll_eval(&c, ll_read(&c, "(add (i64-array 1 2 3) (mul (i64-array 1 2 3) (i64-array 4 5 6)))", NULL));
+  assert(ll_type(a) == D_I64Array && ll_i64s(a)[0] == 5 && ll_i64s(a)[2] == 21);
+  a = ll_eval(&c, ll_read(&c, "(scale (f64-array 1 2 3) 0.5)", NULL));
+  assert(ll_to_float(ll_eval(&c, ll_list(&c, 3, (Object *[]){ll_symbol(&c, "nth"), a, ll_int(&c, 2)}))) == 1.5);
+  a = ll_eval(&c, ll_read(&c, "(scale (i64-array 1 2 3) -2)", NULL));
+  assert(ll_i64s(a)[1] == -4);
+
+  size_t size = 0;
+  a = ll_eval(&c, ll_read(&c, "(vec (f64-array 0.5 1.5) (i64-array 3 -4 5))", NULL));
+  void *image = ll_image_dump(&c, a, &size);
+  assert(image);
+  Object *l = ll_image_load(&c, image, size);
+  free(image);
+  Vector *v = ll_to_vector(l);
+  assert(ll_to_array(v->items[0])->size == 2 && ll_f64s(v->items[0])[1] == 1.5);
+  assert(ll_to_array(v->items[1])->size == 3 && ll_i64s(v->items[1])[1] == -4);
+  image = ll_image_dump(&c, ll_bool(&c, false), &size);
+  ll_define(&c, ll_symbol(&c, "lf"), ll_image_load(&c, image, size));
+  free(image);
+  assert(ll_to_int(ll_eval(&c, ll_read(&c, "(if lf 1 2)", NULL))) == 2); // a loaded false is false
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+/*
+ * Context snapshots. `ll_save_context` writes the heap reachable from a context as a relocatable memory image: the
+ * objects are laid out as one block of Objects followed by their texts and bodies, pointers are stored as block offsets
+ * and CFuncs by their index into a table of builtin names. `ll_restore_context` maps the file, copies the block into
+ * one allocation owned by the context and relocates it in a single pass, rebinding CFuncs by name through
+ * `ll_builtins`. The restored objects are released with the context, they must not be used after `ll_free_context`.
+ * Snapshots are only valid for the pointer and Object size that wrote them.
+ */
+#define LL_SNAPSHOT_MAGIC 0x53474c4cu /* "LLGS" */
+
+typedef struct LLSnapshotHeader {
+  uint32_t magic;
+  uint16_t ptr_size, object_size;
+  uint32_t count; // objects in the block
+  uint32_t names; // CFunc names in front of the block
+  uint64_t bytes; // block size including texts
+  uint64_t root;  // ref of the defined symbols
+} LLSnapshotHeader;
+
+/*
+ * A snapshot ref is the block offset of its target plus one pointer size, 0 is nil. Object refs are always even and
+ * pointer aligned, immediates are stored as they are.
+ */
+static uint64_t ll_snapshot_ref(LLImageWriter *w, Object *o) {
+  if (ll_immediate(o))
+    return (uint64_t)(uintptr_t)o;
+  uint32_t r = ll_image_ref(w, o);
+  if (!r)
+    return 0;
+  size_t i = r & 1 ? w->nobjs + (r >> 1) : (r >> 1) - 1;
+  return i * sizeof(Object) + sizeof(void *);
+}
+
+static uint64_t ll_snapshot_text(LLBuf *texts, size_t count, const char *t) {
+  uint64_t ref = count * sizeof(Object) + texts->n + sizeof(void *);
+  ll_buf_put(texts, t, strlen(t) + 1);
+  return ref;
+}
+
+static void ll_snapshot_place(Object *b, const char *t, LLBuf *texts, size_t count) {
+  if (strlen(t) > 7)
+    b->cdr.i = (long long)ll_snapshot_text(texts, count, t);
+  else
+    memcpy(b->cdr.t, t, strlen(t) + 1);
+}
+
+bool ll_save_context(Context *c, const char *path) {
+  LLImageWriter w = {0};
+  uint32_t root = ll_image_ref(&w, c->defined_symbols);
+  for (size_t i = 0; i < w.nobjs; ++i) {
+    if (ll_type_internal(w.objs[i]) == D_List) {
+      ll_snapshot_ref(&w, w.objs[i]->car.ob);
+      ll_snapshot_ref(&w, w.objs[i]->cdr.ob);
+    } else if (ll_type_internal(w.objs[i]) == D_Vector) {
+      for (size_t j = 0; j < ll_to_vector(w.objs[i])->size; ++j)
+        ll_snapshot_ref(&w, ll_to_vector(w.objs[i])->items[j]);
+    } else if (ll_type_internal(w.objs[i]) == D_Closure) {
+      ll_snapshot_ref(&w, w.objs[i]->cdr.ob);
+    }
+  }
+
+  size_t count = w.nobjs + w.nsyms;
+  Object *block = (Object *)calloc(count ? count : 1, sizeof(Object));
+  LLBuf texts = {0};
+  bool ok = block && !w.failed;
+  for (size_t i = 0; ok && i < w.nobjs; ++i) {
+    Object *x = w.objs[i], *b = block + i;
+    b->car.dt = ll_type_internal(x);
+    switch (b->car.dt) {
+    case D_List:
+      b->car.i = (long long)ll_snapshot_ref(&w, x->car.ob);
+      b->cdr.i = (long long)ll_snapshot_ref(&w, x->cdr.ob);
+      break;
+    case D_Closure:
+      b->cdr.i = (long long)ll_snapshot_ref(&w, x->cdr.ob);
+      break;
+    case D_LongString:
+      ll_snapshot_place(b, x->cdr.lt, &texts, count);
+      break;
+    case D_CFunc: {
+      size_t n = 0;
+      while (n < LL_BUILTIN_COUNT && ll_builtins[n].fn != x->cdr.fn)
+        ++n;
+      ok = n < LL_BUILTIN_COUNT;
+      b->cdr.i = (long long)n;
+      break;
+    }
+    case D_Vector: {
+      static const char pad[8];
+      ll_buf_put(&texts, pad, ll_image_align(texts.n) - texts.n);
+      b->cdr.i = (long long)(count * sizeof(Object) + texts.n + sizeof(void *));
+      Vector *v = ll_to_vector(x);
+      ll_buf_put(&texts, &v->size, sizeof(v->size));
+      for (size_t j = 0; j < v->size; ++j) {
+        Object *item = (Object *)(uintptr_t)ll_snapshot_ref(&w, v->items[j]);
+        ll_buf_put(&texts, &item, sizeof(item));
+      }
+      break;
+    }
+    case D_I64Array:
+    case D_F64Array: {
+      static const char pad[8];
+      ll_buf_put(&texts, pad, ll_image_align(texts.n) - texts.n);
+      b->cdr.i = (long long)(count * sizeof(Object) + texts.n + sizeof(void *));
+      Array *a = ll_to_array(x);
+      ll_buf_put(&texts, a, sizeof(Array) + a->size * sizeof(double));
+      break;
+    }
+    case D_String:
+    case D_Bool:
+    case D_Int:
+    case D_Float:
+      b->cdr = x->cdr;
+      break;
+    default:
+      ok = false;
+    }
+  }
+  for (size_t i = 0; ok && i < w.nsyms; ++i) {
+    Object *b = block + w.nobjs + i;
+    b->car.dt = strlen(w.syms[i]) > 7 ? D_LongSymbol : D_Symbol;
+    ll_snapshot_place(b, w.syms[i], &texts, count);
+  }
+  if (texts.n)
+    ll_buf_put(&texts, "", 1); // texts end with a terminator, even behind binary bodies
+
+  FILE *f = ok && !w.failed && !texts.failed ? fopen(path, "wb") : NULL;
+  if (f) {
+    LLSnapshotHeader h = {LL_SNAPSHOT_MAGIC,
+                          sizeof(void *),
+                          sizeof(Object),
+                          (uint32_t)count,
+                          (uint32_t)LL_BUILTIN_COUNT,
+                          count * sizeof(Object) + texts.n,
+                          root ? ll_snapshot_ref(&w, c->defined_symbols) : 0};
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (size_t n = 0; ok && n < LL_BUILTIN_COUNT; ++n) {
+      uint32_t l = (uint32_t)strlen(ll_builtins[n].name);
+      ok = fwrite(&l, sizeof(l), 1, f) == 1 && fwrite(ll_builtins[n].name, 1, l, f) == l;
+    }
+    ok = ok && fwrite(block, sizeof(Object), count, f) == count && fwrite(texts.b, 1, texts.n, f) == texts.n;
+    ok = fclose(f) == 0 && ok;
+  }
+  free(texts.b);
+  free(block);
+  ll_image_writer_free(&w);
+  return f && ok;
+}
+
+static bool ll_snapshot_relocate(Data *d, char *block, uint64_t lo, uint64_t hi, size_t align) {
+  uint64_t ref = (uint64_t)d->i;
+  if (!ref) {
+    d->ob = NULL;
+    return true;
+  }
+  ref -= sizeof(void *);
+  if (ref < lo || ref >= hi || ref % align)
+    return false;
+  d->lt = block + ref;
+  return true;
+}
+
+static bool ll_snapshot_relocate_object(Data *d, char *block, uint64_t objects) {
+  return ll_immediate(d->ob) || ll_snapshot_relocate(d, block, 0, objects, sizeof(Object));
+}
+
+static bool ll_snapshot_load(Context *c, const unsigned char *m, size_t size) {
+  LLSnapshotHeader h;
+  if (size < sizeof(h))
+    return false;
+  memcpy(&h, m, sizeof(h));
+  if (h.magic != LL_SNAPSHOT_MAGIC || h.ptr_size != sizeof(void *) || h.object_size != sizeof(Object) ||
+      h.bytes > size || h.count > h.bytes / sizeof(Object))
+    return false;
+
+  LLImageReader r = {m + sizeof(h), m + size};
+  CFunc *fns = (CFunc *)calloc(h.names + 1, sizeof(CFunc));
+  bool ok = true;
+  for (uint32_t n = 0; ok && n < h.names; ++n) {
+    uint32_t l;
+    ok = ll_image_get(&r, &l, sizeof(l)) && l <= (size_t)(r.e - r.p);
+    for (size_t i = 0; ok && !fns[n] && i < LL_BUILTIN_COUNT; ++i)
+      if (strlen(ll_builtins[i].name) == l && memcmp(ll_builtins[i].name, r.p, l) == 0)
+        fns[n] = ll_builtins[i].fn;
+    ok = ok && fns[n];
+    r.p += ok ? l : 0;
+  }
+  ok = ok && (uint64_t)(r.e - r.p) == h.bytes;
+
+  char *block = ok ? (char *)gc_malloc(ll_heap, h.bytes ? h.bytes : 1) : NULL;
+  uint64_t objects = (uint64_t)h.count * sizeof(Object);
+  if (block) {
+    memcpy(block, r.p, h.bytes);
+    ok = h.bytes == objects || block[h.bytes - 1] == '\0';
+  }
+  for (uint32_t i = 0; ok && i < h.count; ++i) {
+    Object *o = (Object *)block + i;
+    switch (ll_type_internal(o)) {
+    case D_List:
+      ok = ll_snapshot_relocate_object(&o->car, block, objects) && ll_snapshot_relocate_object(&o->cdr, block, objects);
+      break;
+    case D_Closure:
+      ok = ll_snapshot_relocate_object(&o->cdr, block, objects);
+      break;
+    case D_LongSymbol:
+    case D_LongString:
+      ok = ll_snapshot_relocate(&o->cdr, block, objects, h.bytes, 1);
+      break;
+    case D_CFunc:
+      ok = (uint64_t)o->cdr.i < h.names;
+      if (ok)
+        o->cdr.fn = fns[o->cdr.i];
+      break;
+    case D_Vector: {
+      ok = ll_snapshot_relocate(&o->cdr, block, objects, h.bytes - sizeof(Vector) + 1, sizeof(void *));
+      Vector *v = ok ? (Vector *)o->cdr.cd : NULL;
+      ok = ok && v->size <= (size_t)(block + h.bytes - (char *)v->items) / sizeof(Object *);
+      for (size_t j = 0; ok && j < v->size; ++j) {
+        Data d = {.ob = v->items[j]};
+        ok = ll_snapshot_relocate_object(&d, block, objects);
+        v->items[j] = d.ob;
+      }
+      break;
+    }
+    case D_I64Array:
+    case D_F64Array: {
+      ok = ll_snapshot_relocate(&o->cdr, block, objects, h.bytes - sizeof(Array) + 1, sizeof(void *));
+      Array *a = ok ? (Array *)o->cdr.cd : NULL;
+      ok = ok && a->size <= (size_t)(block + h.bytes - (char *)(a + 1)) / sizeof(double);
+      break;
+    }
+    case D_Symbol:
+    case D_String:
+    case D_Bool:
+    case D_Int:
+    case D_Float:
+      break;
+    default:
+      ok = false;
+    }
+  }
+  Data root = {.i = (long long)h.root};
+  ok = ok && ll_snapshot_relocate_object(&root, block, objects);
+  free(fns);
+
+  if (!ok) {
+    if (block)
+      gc_free(ll_heap, block);
+    return false;
+  }
+  ll_globals_version++;
+  c->defined_symbols = root.ob;
+  c->stack = NULL;
+  c->depth = c->stack_cap = 0;
+  c->form = NULL;
+  c->pinned = 0;
+  c->optimized = NULL;
+  c->snapshot = block; // a root of its own, the objects inside are interior pointers
+  ll_root_context(c, true);
+  return true;
+}
+
+/*
+ * Initializes `c` from a snapshot file, like ll_init_context it is released with ll_free_context, which also releases
+ * the restored objects. A context that was initialized before must be freed first.
+ */
+bool ll_restore_context(Context *c, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *m = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    return false;
+  bool ok = ll_snapshot_load(c, (const unsigned char *)m, (size_t)st.st_size);
+  munmap(m, (size_t)st.st_size);
+  return ok;
+}
+
+void test_context_snapshot() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+  c.defined_symbols = ll_cons(&c, ll_cons(&c, ll_symbol(&c, "a_long_global"), ll_string(&c, "with a long value")),
+                              c.defined_symbols);
+  Object *numbers = ll_list(&c, 4, (Object *[]){ll_int(&c, 7), ll_int(&c, LLONG_MAX), ll_bool(&c, true),
+                                                 ll_read(&c, "[1 \"a long vector string\" [] x]", NULL)});
+  c.defined_symbols = ll_cons(&c, ll_cons(&c, ll_symbol(&c, "numbers"), numbers), c.defined_symbols);
+  Object *samples = ll_eval(&c, ll_read(&c, "(f64-array 0.5 1.5 2.5)", NULL));
+  c.defined_symbols = ll_cons(&c, ll_cons(&c, ll_symbol(&c, "samples"), samples), c.defined_symbols);
+
+  const char *path = "llgc_test.snapshot";
+  bool saved = ll_save_context(&c, path);
+  assert(saved);
+
+  Context r;
+  bool restored = ll_restore_context(&r, path);
+  assert(restored && r.snapshot);
+
+  Object *add = ll_defined_symbol(&r, "+");
+  assert(add && add != ll_defined_symbol(&c, "+") && ll_to_cfunc(add) == ll_eval_add);
+  Object *n = ll_defined_symbol(&r, "numbers");
+  assert(ll_to_int(ll_next(&n)) == 7 && ll_to_int(ll_next(&n)) == LLONG_MAX && ll_to_bool(ll_next(&n)));
+  Vector *v = ll_to_vector(ll_next(&n));
+  assert(!n && v->size == 4 && ll_to_int(v->items[0]) == 1);
+  assert(strcmp(ll_to_string(v->items[1]), "a long vector string") == 0);
+  assert(ll_to_vector(v->items[2])->size == 0 && strcmp(ll_to_symbol(v->items[3]), "x") == 0);
+  Object *samples_r = ll_defined_symbol(&r, "samples");
+  assert(samples_r != samples && ll_to_array(samples_r)->size == 3 && ll_f64s(samples_r)[2] == 2.5);
+  Object *global = ll_car(ll_cdr(ll_cdr(r.defined_symbols)));
+  assert(strcmp(ll_to_symbol(ll_car(global)), "a_long_global") == 0);
+  assert(strcmp(ll_to_string(ll_cdr(global)), "with a long value") == 0);
+  Object *sum = ll_eval(&r, ll_read(&r, "(+ 1 3)", NULL));
+  assert(ll_to_int(sum) == 4);
+
+  void *block = r.snapshot;
+  ll_free_context(&r);
+  assert(!gc_owns(ll_heap, block)); // restoring again does not pile up blocks
+  restored = ll_restore_context(&r, path);
+  assert(restored && r.snapshot);
+  ll_free_context(&r);
+  remove(path);
+
+  restored = ll_restore_context(&r, "llgc_test.does_not_exist");
+  assert(!restored);
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+/*
+ * Bytecode. `ll_compile` translates an expression into register machine code, `ll_run` executes it. Constants live
+ * in a constant pool and operator symbols are resolved once at compile time to their global binding (the VM loads the
+ * binding's value, so redefining a global by updating its binding is seen by compiled code), so evaluation does no
+ * symbol lookups. The numeric builtins take their arguments straight from the registers of the call. Every other
+ * builtin gets a fresh argument list consed from the registers, since builtins may keep their argument list.
+ *
+ * Only calls of global functions and constants are compiled. Special forms and lambdas are not, `ll_compile` fails
+ * for them and it is up to the caller to use `ll_eval` instead. Closures called by compiled code run in the
+ * evaluator through `ll_apply`, so their parameters are bound in environments and not kept in registers.
+ *
+ * An instruction is one 32 bit word: opcode in the low byte, register A in the next byte and operand B in the upper
+ * half. The VM uses threaded dispatch through computed gotos where the compiler supports them.
+ */
+typedef enum OpCode {
+  OP_CONST,  // r[A] = k[B]
+  OP_GLOBAL, // r[A] = cdr(k[B]), k[B] being a global binding
+  OP_CALL,   // r[A] = r[A](r[A + 1] .. r[A + B])
+  OP_RETURN, // return r[A]
+} OpCode;
+
+#define LL_OP(w) ((w)&0xFF)
+#define LL_A(w) (((w) >> 8) & 0xFF)
+#define LL_B(w) ((w) >> 16)
+#define LL_INS(op, a, b) ((uint32_t)(op) | (uint32_t)(a) << 8 | (uint32_t)(b) << 16)
+
+typedef struct Code {
+  size_t nconsts, nops;
+  int nregs;
+  uint32_t *ops;    // points behind the constants
+  Object *consts[]; // constant pool
+} Code;
+
+typedef struct LLCompiler {
+  Context *c;
+  Object **consts; // gc allocated while compiling, constants must stay reachable
+  size_t nconsts, cap_consts;
+  uint32_t *ops;
+  size_t nops, cap_ops;
+  int nregs;
+} LLCompiler;
+
+static uint32_t ll_compile_const(LLCompiler *k, Object *o) {
+  if (k->nconsts == k->cap_consts) {
+    size_t cap = k->cap_consts ? 2 * k->cap_consts : 16;
+    k->consts = (Object **)ll_checked(gc_realloc(ll_heap, k->consts, cap * sizeof(Object *)));
+    k->cap_consts = cap;
+  }
+  k->consts[k->nconsts] = o;
+  return (uint32_t)k->nconsts++;
+}
+
+static void ll_compile_op(LLCompiler *k, uint32_t w) {
+  if (k->nops == k->cap_ops) {
+    k->cap_ops = k->cap_ops ? 2 * k->cap_ops : 32;
+    k->ops = (uint32_t *)realloc(k->ops, k->cap_ops * sizeof(uint32_t));
+  }
+  k->ops[k->nops++] = w;
+}
+
+/* Compiles `o` so that its value ends up in register `r`. */
+static bool ll_compile_expr(LLCompiler *k, Object *o, int r) {
+  if (r >= 0xFF || k->nconsts >= 0xFFFF)
+    return false;
+  if (r + 1 > k->nregs)
+    k->nregs = r + 1;
+  if (ll_type(o) == D_Symbol && ll_defined_binding(k->c, ll_to_symbol(o))) {
+    ll_compile_op(k, LL_INS(OP_GLOBAL, r, ll_compile_const(k, ll_defined_binding(k->c, ll_to_symbol(o)))));
+    return true;
+  }
+  if (ll_type(o) != D_List) {
+    ll_compile_op(k, LL_INS(OP_CONST, r, ll_compile_const(k, o)));
+    return true;
+  }
+
+  Object *fn = ll_car(o);
+  if (ll_type(fn) == D_Symbol) {
+    Object *binding = ll_defined_binding(k->c, ll_to_symbol(fn));
+    if (!binding)
+      return false;
+    ll_compile_op(k, LL_INS(OP_GLOBAL, r, ll_compile_const(k, binding)));
+  } else if (!ll_compile_expr(k, fn, r)) {
+    return false;
+  }
+
+  int argc = 0;
+  for (Object *a = ll_cdr(o); a; ++argc)
+    if (!ll_compile_expr(k, ll_next(&a), r + 1 + argc))
+      return false;
+  ll_compile_op(k, LL_INS(OP_CALL, r, argc));
+  return true;
+}
+
+Object *ll_compile(Context *c, Object *o) {
+  LLCompiler k = {c, NULL, 0, 0, NULL, 0, 0, 0};
+  Object *code = NULL;
+  if (ll_compile_expr(&k, o, 0)) {
+    ll_compile_op(&k, LL_INS(OP_RETURN, 0, 0));
+    size_t size = sizeof(Code) + k.nconsts * sizeof(Object *) + k.nops * sizeof(uint32_t);
+    Code *b = (Code *)ll_checked(gc_malloc(ll_heap, size));
+    b->nconsts = k.nconsts;
+    b->nops = k.nops;
+    b->nregs = k.nregs;
+    memcpy(b->consts, k.consts, k.nconsts * sizeof(Object *));
+    b->ops = (uint32_t *)(b->consts + k.nconsts);
+    memcpy(b->ops, k.ops, k.nops * sizeof(uint32_t));
+    code = ll_malloc(c, D_Code);
+    code->cdr.cd = b;
+  }
+  if (k.consts)
+    gc_free(ll_heap, k.consts);
+  free(k.ops);
+  return code;
+}
+
+#if defined(__GNUC__)
+#define LL_VM_THREADED 1
+#else
+#define LL_VM_THREADED 0
+#endif
+
+static Object *ll_run_code(Context *c, Object *code) {
+  Object *volatile running = code; // the machine only holds pointers into the middle of the code
+  const Code *b = (const Code *)code->cdr.cd;
+  Object *const *k = b->consts;
+  const uint32_t *ip = b->ops;
+  Object *r[b->nregs];
+  uint32_t w;
+
+#if LL_VM_THREADED
+  static const void *labels[] = {&&L_OP_CONST, &&L_OP_GLOBAL, &&L_OP_CALL, &&L_OP_RETURN};
+#define VM_OP(op) L_##op:
+#define VM_NEXT goto *labels[LL_OP(w = *ip++)]
+  VM_NEXT;
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT break
+  for (;;)
+    switch (LL_OP(w = *ip++)) {
+#endif
+  VM_OP(OP_CONST) {
+    r[LL_A(w)] = k[LL_B(w)];
+    VM_NEXT;
+  }
+  VM_OP(OP_GLOBAL) {
+    r[LL_A(w)] = k[LL_B(w)]->cdr.ob;
+    VM_NEXT;
+  }
+  VM_OP(OP_CALL) {
+    Object **x = r + LL_A(w);
+    c->pinned++; // the registers are not roots
+    if (ll_type(x[0]) != D_CFunc || !ll_call_window(c, ll_to_cfunc(x[0]), x + 1, LL_B(w), &x[0])) {
+      Object *args = NULL; // fresh for every call, builtins may keep their arguments
+      for (uint32_t i = LL_B(w); i > 0; --i)
+        args = ll_cons(c, x[i], args);
+      x[0] = ll_type(x[0]) == D_CFunc ? ll_to_cfunc(x[0])(c, args) : ll_apply(c, x[0], args);
+    }
+    c->pinned--;
+    VM_NEXT;
+  }
+  VM_OP(OP_RETURN) {
+    (void)running;
+    return r[LL_A(w)];
+  }
+#if !LL_VM_THREADED
+    }
+#endif
+#undef VM_OP
+#undef VM_NEXT
+}
+
+Object *ll_run(Context *c, Object *code) {
+  assert(ll_type(code) == D_Code);
+  if (ll_failure)
+    return ll_run_code(c, code);
+  jmp_buf failure;
+  size_t depth = c->depth, pinned = c->pinned, nroots = gc_root_mark(ll_heap);
+  Object *r = NULL;
+  ll_failure = &failure;
+  if (!setjmp(failure))
+    r = ll_run_code(c, code);
+  else
+    ll_recover(c, depth, pinned, nroots);
+  ll_failure = NULL;
+  return r;
+}
+
+static Object *test_keep_args(Context *c, Object *args) { return args; }
+
+void test_vm_evaluation() {
+  printf("%s...", __FUNCTION__);
+
+  Context c;
+  ll_init_context(&c);
+
+  Object *src = ll_read(&c, "(+ (+ 1 2) (+ 3 (+ 4 5)))", NULL);
+  Object *code = ll_compile(&c, src);
+  assert(code && ll_type(code) == D_Code);
+  for (int i = 0; i < 1000; ++i)
+    assert(ll_to_int(ll_run(&c, code)) == 15);
+  assert(ll_to_int(ll_eval(&c, src)) == 15);
+
+  // numeric builtins run on the argument registers and agree with their list versions
+  const char *window[] = {"(- 10 (* 2 3) (/ 8 2))", "(- 5)", "(/ 4)", "(+ 1 2.5)", "(< 1 2 (+ 1.5 1.5))",
+                          "(>= 3 3 (- 4 2))", "(= 2 2.0 (/ 4 2))", "(<= 1 (/ 0 0))", "(+)"};
+  for (size_t i = 0; i < sizeof(window) / sizeof(*window); ++i) {
+    Object *x = ll_read(&c, window[i], NULL);
+    Object *compiled = ll_run(&c, ll_compile(&c, x)), *evaluated = ll_eval(&c, x);
+    assert(ll_type(compiled) == ll_type(evaluated));
+    if (ll_type(compiled) == D_Float)
+      assert(ll_to_float(compiled) == ll_to_float(evaluated));
+    else
+      assert(compiled == evaluated); // immediates
+  }
+
+  code = ll_compile(&c, ll_read(&c, "\"atom\"", NULL));
+  assert(strcmp(ll_to_string(ll_run(&c, code)), "atom") == 0);
+
+  assert(!ll_compile(&c, ll_read(&c, "(not_defined 1 2)", NULL)));
+  assert(!ll_compile(&c, ll_read(&c, "(if 1 2 3)", NULL)));
+
+  ll_eval(&c, ll_read(&c, "(define sq (lambda (x) (* x x)))", NULL));
+  code = ll_compile(&c, ll_read(&c, "(+ (sq 3) (sq 4))", NULL));
+  assert(code && ll_to_int(ll_run(&c, code)) == 25);
+  code = ll_compile(&c, ll_read(&c, "(map sq [1 2 3])", NULL));
+  assert(code && ll_to_int(ll_to_vector(ll_run(&c, code))->items[2]) == 9);
+
+  // every call gets its own argument list
+  Object *keep = ll_cons(&c, ll_symbol(&c, "keep"), ll_cfunc(&c, test_keep_args));
+  c.defined_symbols = ll_cons(&c, keep, c.defined_symbols);
+  code = ll_compile(&c, ll_read(&c, "(keep 1 2)", NULL));
+  Object *first = ll_run(&c, code), *second = ll_run(&c, code);
+  assert(first != second && ll_to_int(ll_car(first)) == 1 && ll_to_int(ll_car(ll_cdr(second))) == 2);
+
+  // running out of memory in a closure called by the machine fails the run
+  ll_eval(&c, ll_read(&c, "(define grow (lambda (i acc) (if (= i 0) acc (grow (- i 1) (vec i acc)))))", NULL));
+  code = ll_compile(&c, ll_read(&c, "(+ 1 (grow 100000 0))", NULL));
+  size_t nroots = gc_root_mark(ll_heap);
+  gc_run(ll_heap);
+  gc_heap_limit(ll_heap, ll_heap->heap_size + 4096);
+  assert(code && !ll_run(&c, code) && c.depth == 0 && c.pinned == 0 && gc_root_mark(ll_heap) == nroots);
+  gc_heap_limit(ll_heap, 0);
+
+  ll_free_context(&c);
+
+  printf("%s\n", "ok");
+}
+
+/*
+ * Benchmarks, run with `llgc bench [NAME ...]`. Each benchmark is timed in a few rounds of `n` operations on a fresh
+ * context and reports the best round, so the numbers are comparable across builds of the same machine.
+ */
+typedef struct Bench {
+  const char *name;
+  void (*run)(Context *c, size_t n);
+  size_t n; // operations per round
+} Bench;
+
+static Object *volatile bench_sink; // keeps results observable
+
+static const char *bench_source() {
+  static char src[4096];
+  if (!*src) {
+    strcpy(src, "(");
+    while (strlen(src) + 64 < sizeof(src))
+      strcat(src, "12345 -6.25e3 symbol \"a string\" [1 2 3]\n  ");
+    strcat(src, ")");
+  }
+  return src;
+}
+
+static void bench_reader(Context *c, size_t n) {
+  const char *src = bench_source();
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_read(c, src, NULL);
+}
+
+/* Loads the image of the forms `reader` parses, the two are directly comparable. */
+static void bench_image_load(Context *c, size_t n) {
+  size_t size;
+  void *image = ll_image_dump(c, ll_read(c, bench_source(), NULL), &size);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_image_load(c, image, size);
+  free(image);
+}
+
+/* Starting a context from scratch, against restoring a snapshot of a fresh context. */
+static void bench_context_init(Context *c, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    Context r;
+    ll_init_context(&r);
+    ll_free_context(&r);
+  }
+}
+
+static void bench_context_restore(Context *c, size_t n) {
+  const char *path = "llgc_bench.snapshot";
+  bool saved = ll_save_context(c, path);
+  assert(saved);
+  for (size_t i = 0; i < n && saved; ++i) {
+    Context r;
+    if (!ll_restore_context(&r, path))
+      break;
+    ll_free_context(&r);
+  }
+  remove(path);
+}
+
+static void bench_vm(Context *c, size_t n) {
+  Object *code = ll_compile(c, ll_read(c, "(+ (+ 1 2) (+ 3 (+ 4 5)))", NULL));
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_run(c, code);
+}
+
+static void bench_eval(Context *c, size_t n) {
+  Object *src = ll_read(c, "(+ (+ 1 2) (+ 3 (+ 4 5)))", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+/* Defines `name` as a vector of the integers 0 .. n - 1. */
+static void bench_numbers(Context *c, const char *name, size_t n) {
+  Object *v = ll_vector(c, n);
+  for (size_t i = 0; i < n; ++i)
+    ll_to_vector(v)->items[i] = ll_int(c, (long long)i);
+  ll_define(c, ll_symbol(c, name), v);
+}
+
+static void bench_vector_fold(Context *c, size_t n) {
+  bench_numbers(c, "xs", 1000);
+  Object *src = ll_read(c, "(fold (lambda (a x) (+ a x)) 0 xs)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+/* Array kernels against the same computation over a vector of 1000 fixnums. */
+static void bench_array_eval(Context *c, size_t n, const char *expr) {
+  bench_numbers(c, "xs", 1000);
+  ll_eval(c, ll_read(c, "(define as (i64-array xs))", NULL));
+  Object *src = ll_read(c, expr, NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_dot_array(Context *c, size_t n) { bench_array_eval(c, n, "(dot as as)"); }
+static void bench_dot_vector(Context *c, size_t n) { bench_array_eval(c, n, "(fold (lambda (s x) (+ s (* x x))) 0 xs)"); }
+static void bench_scale_array(Context *c, size_t n) { bench_array_eval(c, n, "(scale as 3)"); }
+static void bench_scale_vector(Context *c, size_t n) { bench_array_eval(c, n, "(map (lambda (x) (* x 3)) xs)"); }
+
+/* The i64 dot kernel of the scalar set, against the one picked for this CPU. */
+static void bench_dot_kernel(size_t n, const ArrayKernels *k) {
+  long long a[1000];
+  for (size_t i = 0; i < 1000; ++i)
+    a[i] = (long long)i;
+  long long s = 0;
+  for (size_t i = 0; i < n; ++i)
+    s += k->i64_dot(a, a, 1000);
+  bench_sink = (Object *)(uintptr_t)(s & ~(long long)7);
+}
+
+static void bench_dot_scalar(Context *c, size_t n) { bench_dot_kernel(n, &ll_scalar_kernels); }
+static void bench_dot_dispatch(Context *c, size_t n) { bench_dot_kernel(n, ll_kernels()); }
+
+static void bench_vector_nth(Context *c, size_t n) {
+  bench_numbers(c, "xs", 1000);
+  Object *src = ll_read(c, "(nth xs 999)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_arith_int(Context *c, size_t n) {
+  Object *src = ll_read(c, "(+ 1 2 3 4 5 6 7 8)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_arith_mixed(Context *c, size_t n) {
+  Object *src = ll_read(c, "(* 1.5 2 3 4 0.5 6 7 8)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static const char *bench_loop = "(define loop (lambda (i acc) (if (= i 0) acc (loop (- i 1) (+ acc i)))))";
+
+static void bench_tail_loop(Context *c, size_t n) {
+  ll_eval(c, ll_read(c, bench_loop, NULL));
+  Object *src = ll_read(c, "(loop 1000 0)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_resume_loop(Context *c, size_t n) {
+  ll_eval(c, ll_read(c, bench_loop, NULL));
+  Object *src = ll_read(c, "(loop 1000 0)", NULL);
+  for (size_t i = 0; i < n; ++i) {
+    Object *r = ll_eval_start(c, src, 100);
+    while (ll_suspended(r))
+      r = ll_resume(c, r, 100);
+    bench_sink = r;
+  }
+}
+
+static void bench_global_call(Context *c, size_t n) {
+  ll_eval(c, ll_read(c, "(define f (lambda (x) x))", NULL));
+  Object *src = ll_read(c, "(f (+ 1 2))", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_map(Context *c, size_t n) {
+  bench_numbers(c, "xs", 1000);
+  ll_eval(c, ll_read(c, bench_loop, NULL));
+  Object *src = ll_read(c, "(map (lambda (x) (loop 10 x)) xs)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static void bench_pmap(Context *c, size_t n) {
+  bench_numbers(c, "xs", 1000);
+  ll_eval(c, ll_read(c, bench_loop, NULL));
+  Object *src = ll_read(c, "(pmap (lambda (x) (loop 10 x)) xs)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+/* pmap over items that each take a few microseconds, on a fixed number of workers, to show how pmap scales. */
+static void bench_pmap_scaling(Context *c, size_t n, size_t workers) {
+  bench_numbers(c, "xs", 1000);
+  ll_eval(c, ll_read(c, bench_loop, NULL));
+  Object *src = ll_read(c, "(pmap (lambda (x) (loop 50 x)) xs)", NULL);
+  ll_set_workers(workers);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+  ll_set_workers(0);
+}
+
+static void bench_pmap_1(Context *c, size_t n) { bench_pmap_scaling(c, n, 1); }
+static void bench_pmap_2(Context *c, size_t n) { bench_pmap_scaling(c, n, 2); }
+static void bench_pmap_4(Context *c, size_t n) { bench_pmap_scaling(c, n, 4); }
+static void bench_pmap_8(Context *c, size_t n) { bench_pmap_scaling(c, n, 8); }
+static void bench_pmap_16(Context *c, size_t n) { bench_pmap_scaling(c, n, 16); }
+
+/* Builds a 100 MB string from 16 byte pieces and flattens it with str, per piece. */
+static void bench_builder_append(Context *c, size_t n) {
+  Object *b = ll_builder(c);
+  ll_define(c, ll_symbol(c, "b"), b);
+  for (size_t i = 0; i < n; ++i)
+    ll_builder_append(b, "a piece of text ", 16);
+  bench_sink = ll_eval(c, ll_read(c, "(str b)", NULL));
+  assert(strlen(ll_to_string(bench_sink)) == n * 16);
+}
+
+/* The reader bench without the heap profiler, with its default interval and sampling every 4 KiB. */
+static void bench_profiled(Context *c, size_t n, size_t interval) {
+  const char *src = bench_source();
+  if (interval)
+    ll_profile_start(c, interval, NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_read(c, src, NULL);
+  gc_profile_stop(ll_heap);
+}
+
+static void bench_profile_off(Context *c, size_t n) { bench_profiled(c, n, 0); }
+static void bench_profile_on(Context *c, size_t n) { bench_profiled(c, n, GC_PROFILE_INTERVAL); }
+static void bench_profile_dense(Context *c, size_t n) { bench_profiled(c, n, 4096); }
+
+static void bench_join(Context *c, size_t n) {
+  Object *v = ll_vector(c, 100);
+  for (size_t i = 0; i < 100; ++i)
+    ll_to_vector(v)->items[i] = ll_string(c, i % 2 ? "a longer word" : "short");
+  ll_define(c, ll_symbol(c, "words"), v);
+  Object *src = ll_read(c, "(join \", \" words)", NULL);
+  for (size_t i = 0; i < n; ++i)
+    bench_sink = ll_eval(c, src);
+}
+
+static const Bench benches[] = {
+    {"reader", bench_reader, 1000},
+    {"image-load", bench_image_load, 1000},
+    {"context-init", bench_context_init, 10000},
+    {"context-restore", bench_context_restore, 10000},
+    {"vm", bench_vm, 100000},
+    {"eval", bench_eval, 100000},
+    {"vector-fold", bench_vector_fold, 50},
+    {"vector-nth", bench_vector_nth, 100000},
+    {"dot-array", bench_dot_array, 100000},
+    {"dot-vector", bench_dot_vector, 1000},
+    {"dot-scalar", bench_dot_scalar, 100000},
+    {"dot-dispatch", bench_dot_dispatch, 100000},
+    {"scale-array", bench_scale_array, 100000},
+    {"scale-vector", bench_scale_vector, 1000},
+    {"arith-int", bench_arith_int, 100000},
+    {"arith-mixed", bench_arith_mixed, 100000},
+    {"tail-loop", bench_tail_loop, 50},
+    {"resume-loop", bench_resume_loop, 50},
+    {"global-call", bench_global_call, 100000},
+    {"map", bench_map, 2},
+    {"pmap", bench_pmap, 2},
+    {"pmap-1", bench_pmap_1, 2},
+    {"pmap-2", bench_pmap_2, 2},
+    {"pmap-4", bench_pmap_4, 2},
+    {"pmap-8", bench_pmap_8, 2},
+    {"pmap-16", bench_pmap_16, 2},
+    {"builder-append", bench_builder_append, 100 << 20 >> 4},
+    {"join", bench_join, 10000},
+    {"profile-off", bench_profile_off, 1000},
+    {"profile-on", bench_profile_on, 1000},
+    {"profile-dense", bench_profile_dense, 1000},
+};
+
+static double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_main(int argc, char *argv[]) {
+  for (size_t b = 0; b < sizeof(benches) / sizeof(*benches); ++b) {
+    bool selected = !argc;
+    for (int i = 0; i < argc; ++i)
+      selected |= !strcmp(argv[i], benches[b].name);
+    if (!selected)
+      continue;
+    double best = 0;
+    for (int round = 0; round < 5; ++round) {
+      Context c;
+      ll_init_context(&c);
+      double start = bench_now();
+      benches[b].run(&c, benches[b].n);
+      double ns = bench_now() - start;
+      best = round && best < ns ? best : ns;
+      ll_free_context(&c);
+      gc_run(ll_heap);
+    }
+    printf("%-16s %12.1f ns/op\n", benches[b].name, best / benches[b].n);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  printf("(hi %s)\n", "llgc");
+
+  gc_start(&gc, &argc);
+
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    int r = bench_main(argc - 2, argv + 2);
+    gc_stop(&gc);
+    return r;
+  }
+
+  test_Location();
+  test_DataType();
+  test_object_atoms();
+  test_object_list_creation();
+  test_object_list_interaction();
+  test_object_vectors();
 
   test_parsing_atoms();
   test_parsing_lists();
+  test_parsing_locations();
+
+  test_image_roundtrip();
 
   test_context_initialization();
   test_context_evaluation();
+  test_context_tail_calls();
+  test_context_call_caches();
+  test_context_optimization();
+  test_context_resumable();
+  test_context_parallel();
+  test_string_builders();
+  test_weak_tables();
+  test_heap_profile();
+  test_large_objects();
+  test_heap_limit();
+  test_backing_allocators();
+  test_precise_roots();
+  test_external_memory();
+  test_allocation_trace();
+  test_numeric_arrays();
+  test_context_snapshot();
+  test_vm_evaluation();
 
   gc_stop(&gc);
 